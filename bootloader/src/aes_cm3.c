@@ -0,0 +1,420 @@
+// Copyright 2023 The MITRE Corporation. ALL RIGHTS RESERVED
+// Approved for public release. Distribution unlimited 23-02181-13.
+
+/*
+ * AES-128-CTR and fused AES-GCM tuned for the Cortex-M3.
+ *
+ * - A single encryption T-table plus the S-box live in SRAM (.bss, filled on
+ *   first init), so lookups do not wait on flash or compete with flash
+ *   programming. The other three tables are rotations of the first; on
+ *   Thumb-2 the rotation folds into the EOR for free (EOR Rd, Rn, Rm, ROR #n).
+ * - All ten rounds are unrolled.
+ * - Data is handled a word at a time: one REV per load/store, word-wise XOR
+ *   with the keystream (the M3 allows unaligned LDR/STR).
+ * - aes_cm3_gcm_run() computes the keystream and GHASH in the same pass over
+ *   each block, instead of BearSSL's separate CTR and GHASH passes.
+ *
+ * Not constant time: the table lookups are key and data dependent.
+ */
+#include "aes_cm3.h"
+
+#include <string.h>
+
+static uint8_t sbox[256];
+static uint32_t te0[256];
+static int tables_ready = 0;
+
+static const uint8_t rcon[10] = {0x01, 0x02, 0x04, 0x08, 0x10, 0x20, 0x40, 0x80, 0x1B, 0x36};
+
+// Reduction constants for shifting the GHASH accumulator right by 4 bits
+static const uint16_t last4[16] = {
+    0x0000, 0x1C20, 0x3840, 0x2460, 0x7080, 0x6CA0, 0x48C0, 0x54E0,
+    0xE100, 0xFD20, 0xD940, 0xC560, 0x9180, 0x8DA0, 0xA9C0, 0xB5E0};
+
+#define ROR(x, n) (((x) >> (n)) | ((x) << (32 - (n))))
+
+static inline uint32_t load_be32(const uint8_t *p)
+{
+    uint32_t w;
+    memcpy(&w, p, 4);
+    return __builtin_bswap32(w);
+}
+
+static inline void store_be32(uint8_t *p, uint32_t w)
+{
+    w = __builtin_bswap32(w);
+    memcpy(p, &w, 4);
+}
+
+static uint8_t xtime(uint8_t x)
+{
+    return (uint8_t)((x << 1) ^ ((x & 0x80) ? 0x1B : 0x00));
+}
+
+/*
+ * Build the S-box and T-table on first use rather than storing 1.25 KiB of
+ * constants in flash.
+ */
+static void tables_init(void)
+{
+    uint8_t p = 1, q = 1;
+
+    if (tables_ready)
+    {
+        return;
+    }
+
+    do
+    {
+        // p walks the multiplicative group, q tracks its inverse
+        p = p ^ xtime(p);
+        q ^= q << 1;
+        q ^= q << 2;
+        q ^= q << 4;
+        if (q & 0x80)
+        {
+            q ^= 0x09;
+        }
+        uint8_t x = q ^ (uint8_t)((q << 1) | (q >> 7)) ^ (uint8_t)((q << 2) | (q >> 6))
+                      ^ (uint8_t)((q << 3) | (q >> 5)) ^ (uint8_t)((q << 4) | (q >> 4));
+        sbox[p] = x ^ 0x63;
+    } while (p != 1);
+    sbox[0] = 0x63;
+
+    for (int i = 0; i < 256; i++)
+    {
+        uint8_t s = sbox[i];
+        uint8_t s2 = xtime(s);
+        te0[i] = ((uint32_t)s2 << 24) | ((uint32_t)s << 16) | ((uint32_t)s << 8) | (uint32_t)(s2 ^ s);
+    }
+    tables_ready = 1;
+}
+
+static void key_expand(uint32_t *rk, const uint8_t *key)
+{
+    for (int i = 0; i < 4; i++)
+    {
+        rk[i] = load_be32(key + 4 * i);
+    }
+    for (int i = 4; i < 44; i++)
+    {
+        uint32_t t = rk[i - 1];
+        if ((i & 3) == 0)
+        {
+            t = ((uint32_t)sbox[(t >> 16) & 0xFF] << 24) ^ ((uint32_t)sbox[(t >> 8) & 0xFF] << 16)
+              ^ ((uint32_t)sbox[t & 0xFF] << 8) ^ (uint32_t)sbox[t >> 24]
+              ^ ((uint32_t)rcon[(i >> 2) - 1] << 24);
+        }
+        rk[i] = rk[i - 4] ^ t;
+    }
+}
+
+#define ROUND(o0, o1, o2, o3, i0, i1, i2, i3, k)                                                               \
+    o0 = te0[i0 >> 24] ^ ROR(te0[(i1 >> 16) & 0xFF], 8) ^ ROR(te0[(i2 >> 8) & 0xFF], 16) ^ ROR(te0[i3 & 0xFF], 24) ^ (k)[0]; \
+    o1 = te0[i1 >> 24] ^ ROR(te0[(i2 >> 16) & 0xFF], 8) ^ ROR(te0[(i3 >> 8) & 0xFF], 16) ^ ROR(te0[i0 & 0xFF], 24) ^ (k)[1]; \
+    o2 = te0[i2 >> 24] ^ ROR(te0[(i3 >> 16) & 0xFF], 8) ^ ROR(te0[(i0 >> 8) & 0xFF], 16) ^ ROR(te0[i1 & 0xFF], 24) ^ (k)[2]; \
+    o3 = te0[i3 >> 24] ^ ROR(te0[(i0 >> 16) & 0xFF], 8) ^ ROR(te0[(i1 >> 8) & 0xFF], 16) ^ ROR(te0[i2 & 0xFF], 24) ^ (k)[3];
+
+#define FINAL(i0, i1, i2, i3, k)                                                                               \
+    (((uint32_t)sbox[i0 >> 24] << 24) ^ ((uint32_t)sbox[(i1 >> 16) & 0xFF] << 16)                             \
+     ^ ((uint32_t)sbox[(i2 >> 8) & 0xFF] << 8) ^ (uint32_t)sbox[i3 & 0xFF] ^ (k))
+
+/*
+ * Encrypt one block held as four big-endian words, in place.
+ */
+static void encrypt_block(const uint32_t *rk, uint32_t *b)
+{
+    uint32_t s0 = b[0] ^ rk[0], s1 = b[1] ^ rk[1], s2 = b[2] ^ rk[2], s3 = b[3] ^ rk[3];
+    uint32_t t0, t1, t2, t3;
+
+    ROUND(t0, t1, t2, t3, s0, s1, s2, s3, rk + 4)
+    ROUND(s0, s1, s2, s3, t0, t1, t2, t3, rk + 8)
+    ROUND(t0, t1, t2, t3, s0, s1, s2, s3, rk + 12)
+    ROUND(s0, s1, s2, s3, t0, t1, t2, t3, rk + 16)
+    ROUND(t0, t1, t2, t3, s0, s1, s2, s3, rk + 20)
+    ROUND(s0, s1, s2, s3, t0, t1, t2, t3, rk + 24)
+    ROUND(t0, t1, t2, t3, s0, s1, s2, s3, rk + 28)
+    ROUND(s0, s1, s2, s3, t0, t1, t2, t3, rk + 32)
+    ROUND(t0, t1, t2, t3, s0, s1, s2, s3, rk + 36)
+
+    b[0] = FINAL(t0, t1, t2, t3, rk[40]);
+    b[1] = FINAL(t1, t2, t3, t0, rk[41]);
+    b[2] = FINAL(t2, t3, t0, t1, rk[42]);
+    b[3] = FINAL(t3, t0, t1, t2, rk[43]);
+}
+
+/*
+ * XOR up to 16 bytes of keystream into data. Full blocks go a word at a time.
+ */
+static inline void xor_block(uint8_t *data, const uint32_t *ks, size_t n)
+{
+    if (n == 16)
+    {
+        for (int i = 0; i < 4; i++)
+        {
+            store_be32(data + 4 * i, load_be32(data + 4 * i) ^ ks[i]);
+        }
+        return;
+    }
+    for (size_t i = 0; i < n; i++)
+    {
+        data[i] ^= (uint8_t)(ks[i >> 2] >> (24 - 8 * (i & 3)));
+    }
+}
+
+void aes_cm3_ctr_init(aes_cm3_ctr_keys *ctx, const void *key, size_t len)
+{
+    // AES-128 only; the device keys are 16 bytes
+    (void)len;
+    tables_init();
+    ctx->vtable = &aes_cm3_ctr_vtable;
+    key_expand(ctx->rk, key);
+}
+
+uint32_t aes_cm3_ctr_run(const aes_cm3_ctr_keys *ctx, const void *iv, uint32_t cc, void *data, size_t len)
+{
+    const uint8_t *ivb = iv;
+    uint8_t *buf = data;
+    uint32_t n0 = load_be32(ivb), n1 = load_be32(ivb + 4), n2 = load_be32(ivb + 8);
+
+    while (len > 0)
+    {
+        uint32_t ks[4] = {n0, n1, n2, cc++};
+        size_t n = len < 16 ? len : 16;
+        encrypt_block(ctx->rk, ks);
+        xor_block(buf, ks, n);
+        buf += n;
+        len -= n;
+    }
+    return cc;
+}
+
+static void ctr_vtable_init(const br_block_ctr_class **ctx, const void *key, size_t len)
+{
+    aes_cm3_ctr_init((aes_cm3_ctr_keys *)ctx, key, len);
+}
+
+static uint32_t ctr_vtable_run(const br_block_ctr_class *const *ctx, const void *iv, uint32_t cc, void *data, size_t len)
+{
+    return aes_cm3_ctr_run((const aes_cm3_ctr_keys *)ctx, iv, cc, data, len);
+}
+
+const br_block_ctr_class aes_cm3_ctr_vtable = {
+    sizeof(aes_cm3_ctr_keys),
+    16,
+    4,
+    ctr_vtable_init,
+    ctr_vtable_run};
+
+/*
+ * y = (y ^ x) * H in GF(2^128), Shoup's 4-bit table method. All values are
+ * big-endian words; y[0] holds the most significant (first) bytes.
+ */
+static void ghash_block(const uint32_t htab[16][4], uint32_t *y, const uint32_t *x)
+{
+    uint32_t v[4] = {y[0] ^ x[0], y[1] ^ x[1], y[2] ^ x[2], y[3] ^ x[3]};
+    uint32_t z0, z1, z2, z3, rem;
+    int first = 1;
+
+    z0 = z1 = z2 = z3 = 0;
+    for (int w = 3; w >= 0; w--)
+    {
+        uint32_t word = v[w];
+        for (int nib = 0; nib < 8; nib++)
+        {
+            uint32_t idx = word & 0xF;
+            word >>= 4;
+            if (!first)
+            {
+                rem = z3 & 0xF;
+                z3 = (z3 >> 4) | (z2 << 28);
+                z2 = (z2 >> 4) | (z1 << 28);
+                z1 = (z1 >> 4) | (z0 << 28);
+                z0 = (z0 >> 4) ^ ((uint32_t)last4[rem] << 16);
+            }
+            first = 0;
+            z0 ^= htab[idx][0];
+            z1 ^= htab[idx][1];
+            z2 ^= htab[idx][2];
+            z3 ^= htab[idx][3];
+        }
+    }
+    y[0] = z0;
+    y[1] = z1;
+    y[2] = z2;
+    y[3] = z3;
+}
+
+/*
+ * Start a context on an expanded key. Nothing is derived or copied, so this
+ * costs the same for every message.
+ */
+void aes_cm3_gcm_init(aes_cm3_gcm_context *ctx, const uint32_t rk[44], const uint32_t htab[16][4])
+{
+    tables_init();
+    ctx->rk = rk;
+    ctx->htab = htab;
+}
+
+void aes_cm3_gcm_reset(aes_cm3_gcm_context *ctx, const void *iv, size_t len)
+{
+    // 96-bit IV only: J0 = IV || 1
+    (void)len;
+    const uint8_t *ivb = iv;
+    ctx->j0[0] = load_be32(ivb);
+    ctx->j0[1] = load_be32(ivb + 4);
+    ctx->j0[2] = load_be32(ivb + 8);
+    ctx->j0[3] = 1;
+    ctx->jc = 2;
+    memset(ctx->y, 0, sizeof(ctx->y));
+    ctx->buf_len = 0;
+    ctx->count_aad = 0;
+    ctx->count_ctr = 0;
+}
+
+void aes_cm3_gcm_aad_inject(aes_cm3_gcm_context *ctx, const void *data, size_t len)
+{
+    const uint8_t *p = data;
+    uint32_t x[4];
+
+    ctx->count_aad += len;
+    while (len > 0)
+    {
+        size_t n = 16 - ctx->buf_len;
+        if (n > len)
+        {
+            n = len;
+        }
+        if (ctx->buf_len == 0 && len >= 16)
+        {
+            // Whole block straight from the caller's buffer
+            for (int i = 0; i < 4; i++)
+            {
+                x[i] = load_be32(p + 4 * i);
+            }
+            ghash_block(ctx->htab, ctx->y, x);
+            p += 16;
+            len -= 16;
+            continue;
+        }
+        memcpy(ctx->buf + ctx->buf_len, p, n);
+        ctx->buf_len += n;
+        p += n;
+        len -= n;
+        if (ctx->buf_len == 16)
+        {
+            for (int i = 0; i < 4; i++)
+            {
+                x[i] = load_be32(ctx->buf + 4 * i);
+            }
+            ghash_block(ctx->htab, ctx->y, x);
+            ctx->buf_len = 0;
+        }
+    }
+}
+
+void aes_cm3_gcm_flip(aes_cm3_gcm_context *ctx)
+{
+    uint32_t x[4];
+
+    // Zero-pad the last AAD block
+    if (ctx->buf_len > 0)
+    {
+        memset(ctx->buf + ctx->buf_len, 0, 16 - ctx->buf_len);
+        for (int i = 0; i < 4; i++)
+        {
+            x[i] = load_be32(ctx->buf + 4 * i);
+        }
+        ghash_block(ctx->htab, ctx->y, x);
+        ctx->buf_len = 0;
+    }
+}
+
+/*
+ * Encrypt or decrypt in place. For every block the keystream is generated
+ * and the ciphertext folded into GHASH while the block is in registers.
+ */
+void aes_cm3_gcm_run(aes_cm3_gcm_context *ctx, int encrypt, void *data, size_t len)
+{
+    uint8_t *buf = data;
+    uint32_t c[4];
+
+    ctx->count_ctr += len;
+    while (len > 0)
+    {
+        size_t n = len < 16 ? len : 16;
+        uint32_t ks[4] = {ctx->j0[0], ctx->j0[1], ctx->j0[2], ctx->jc++};
+        encrypt_block(ctx->rk, ks);
+
+        if (!encrypt)
+        {
+            if (n == 16)
+            {
+                for (int i = 0; i < 4; i++)
+                {
+                    c[i] = load_be32(buf + 4 * i);
+                }
+            }
+            else
+            {
+                uint8_t tmp[16] = {0};
+                memcpy(tmp, buf, n);
+                for (int i = 0; i < 4; i++)
+                {
+                    c[i] = load_be32(tmp + 4 * i);
+                }
+            }
+            ghash_block(ctx->htab, ctx->y, c);
+            xor_block(buf, ks, n);
+        }
+        else
+        {
+            xor_block(buf, ks, n);
+            uint8_t tmp[16] = {0};
+            memcpy(tmp, buf, n);
+            for (int i = 0; i < 4; i++)
+            {
+                c[i] = load_be32(tmp + 4 * i);
+            }
+            ghash_block(ctx->htab, ctx->y, c);
+        }
+
+        buf += n;
+        len -= n;
+    }
+}
+
+void aes_cm3_gcm_get_tag(aes_cm3_gcm_context *ctx, void *tag)
+{
+    uint32_t lens[4], ek[4];
+    uint8_t *t = tag;
+
+    // Length block: bit lengths of AAD and ciphertext
+    lens[0] = ctx->count_aad >> 29;
+    lens[1] = ctx->count_aad << 3;
+    lens[2] = ctx->count_ctr >> 29;
+    lens[3] = ctx->count_ctr << 3;
+    ghash_block(ctx->htab, ctx->y, lens);
+
+    memcpy(ek, ctx->j0, sizeof(ek));
+    encrypt_block(ctx->rk, ek);
+    for (int i = 0; i < 4; i++)
+    {
+        store_be32(t + 4 * i, ctx->y[i] ^ ek[i]);
+    }
+}
+
+uint32_t aes_cm3_gcm_check_tag(aes_cm3_gcm_context *ctx, const void *tag)
+{
+    uint8_t computed[16];
+    const uint8_t *t = tag;
+    uint8_t diff = 0;
+
+    aes_cm3_gcm_get_tag(ctx, computed);
+    for (int i = 0; i < 16; i++)
+    {
+        diff |= computed[i] ^ t[i];
+    }
+    return diff == 0;
+}
+
@@ -0,0 +1,55 @@
+// Copyright 2023 The MITRE Corporation. ALL RIGHTS RESERVED
+// Approved for public release. Distribution unlimited 23-02181-13.
+
+/*
+ * AES-128-CTR and fused AES-GCM tuned for the Cortex-M3 (ARMv7-M).
+ *
+ * Selected with `make AES_IMPL=cm3`. Results are bit-identical to BearSSL's
+ * br_aes_big_ctr_vtable + br_gcm; see crypto_bench() in bootloader.c.
+ */
+#ifndef AES_CM3_H
+#define AES_CM3_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <bearssl.h>
+
+// CTR context, usable anywhere BearSSL takes a br_block_ctr_class
+typedef struct
+{
+    const br_block_ctr_class *vtable;
+    uint32_t rk[44]; // AES-128 round keys, big-endian words
+} aes_cm3_ctr_keys;
+
+extern const br_block_ctr_class aes_cm3_ctr_vtable;
+
+void aes_cm3_ctr_init(aes_cm3_ctr_keys *ctx, const void *key, size_t len);
+uint32_t aes_cm3_ctr_run(const aes_cm3_ctr_keys *ctx, const void *iv, uint32_t cc, void *data, size_t len);
+
+// GCM context. The call sequence mirrors br_gcm: init, reset, aad_inject,
+// flip, run, check_tag. Only a 12-byte IV is supported, and only the last
+// run() call of a message may have a length that is not a multiple of 16.
+// The key-dependent round keys and GHASH table are not part of the context:
+// it points at them, as produced by bl_build.py.
+typedef struct
+{
+    const uint32_t *rk;        // AES-128 round keys, 44 big-endian words
+    const uint32_t (*htab)[4]; // multiples of H for 4-bit GHASH
+    uint32_t y[4];             // GHASH accumulator
+    uint32_t j0[4];       // pre-counter block
+    uint8_t buf[16];      // partial AAD block
+    uint32_t buf_len;
+    uint32_t jc;          // next CTR counter
+    uint32_t count_aad;
+    uint32_t count_ctr;
+} aes_cm3_gcm_context;
+
+void aes_cm3_gcm_init(aes_cm3_gcm_context *ctx, const uint32_t rk[44], const uint32_t htab[16][4]);
+void aes_cm3_gcm_reset(aes_cm3_gcm_context *ctx, const void *iv, size_t len);
+void aes_cm3_gcm_aad_inject(aes_cm3_gcm_context *ctx, const void *data, size_t len);
+void aes_cm3_gcm_flip(aes_cm3_gcm_context *ctx);
+void aes_cm3_gcm_run(aes_cm3_gcm_context *ctx, int encrypt, void *data, size_t len);
+void aes_cm3_gcm_get_tag(aes_cm3_gcm_context *ctx, void *tag);
+uint32_t aes_cm3_gcm_check_tag(aes_cm3_gcm_context *ctx, const void *tag);
+
+#endif
@@ -0,0 +1,56 @@
+// Copyright 2023 The MITRE Corporation. ALL RIGHTS RESERVED
+// Approved for public release. Distribution unlimited 23-02181-13.
+
+#include <stddef.h>
+#include "arena.h"
+
+static uint8_t arena[ARENA_SIZE] __attribute__((aligned(ARENA_ALIGN)));
+static uint32_t arena_used = 0;
+static uint32_t arena_high = 0;
+
+/*
+ * Take size bytes from the arena, rounded up to ARENA_ALIGN.
+ */
+void *arena_alloc(uint32_t size)
+{
+    size = (size + ARENA_ALIGN - 1) & ~(uint32_t)(ARENA_ALIGN - 1);
+    if (size > ARENA_SIZE - arena_used)
+    {
+        return NULL;
+    }
+
+    void *p = &arena[arena_used];
+    arena_used += size;
+    if (arena_used > arena_high)
+    {
+        arena_high = arena_used;
+    }
+    return p;
+}
+
+/*
+ * Current fill level, to hand back to arena_release().
+ */
+uint32_t arena_mark(void)
+{
+    return arena_used;
+}
+
+/*
+ * Free everything allocated since mark was taken.
+ */
+void arena_release(uint32_t mark)
+{
+    if (mark < arena_used)
+    {
+        arena_used = mark;
+    }
+}
+
+/*
+ * Most bytes ever in use since reset.
+ */
+uint32_t arena_peak(void)
+{
+    return arena_high;
+}
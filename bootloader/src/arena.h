@@ -0,0 +1,28 @@
+// Copyright 2023 The MITRE Corporation. ALL RIGHTS RESERVED
+// Approved for public release. Distribution unlimited 23-02181-13.
+
+/*
+ * Fixed static arena for the bootloader's large working buffers.
+ *
+ * Frames, pages and crypto contexts are carved out of one statically sized
+ * block instead of the stack, so peak RAM use is known at link time and does
+ * not depend on the image being loaded. Allocation is a bump pointer with
+ * mark/release, and the peak is tracked for the 'M' command.
+ */
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stdint.h>
+
+// Sized for the update engine: package header, component table, page-hash
+// manifest, one frame per host link (2 when striped), CHUNK_SLOTS (2)
+// chunks, a SHA-256 context and one GCM context (or a Merkle tree level)
+#define ARENA_SIZE 4864
+#define ARENA_ALIGN 8
+
+void *arena_alloc(uint32_t size); // NULL when the arena is exhausted
+uint32_t arena_mark(void);
+void arena_release(uint32_t mark);
+uint32_t arena_peak(void);
+
+#endif
@@ -12,11 +12,16 @@
 #include "inc/lm3s6965.h"  // Peripheral Bit Masks and Registers
 #include "inc/hw_types.h"  // Boolean type
 #include "inc/hw_ints.h"   // Interrupt numbers
+#include "inc/hw_uart.h"   // UART register offsets
+#include "inc/hw_flash.h"  // Flash controller registers
+#include "inc/hw_nvic.h"   // NVIC registers (VTOR, pending interrupts)
 
 // Driver API Imports
 #include "driverlib/flash.h"     // FLASH API
 #include "driverlib/sysctl.h"    // System control API (clock/reset)
 #include "driverlib/interrupt.h" // Interrupt API
+#include "driverlib/uart.h"      // UART API (baud rate divisors)
+#include "driverlib/systick.h"   // SysTick API (cycle counting)
 
 #include "bootloader_secrets.h"
 
@@ -32,29 +37,55 @@
 
 // Application Imports
 #include "uart.h"
+#include "aes_cm3.h"
+#include "arena.h"
+#include "trace.h"
+#include "crc32.h"
+#include "sched.h"
+#include "bootloader.h"
+#include "update.h"
 
 // Forward Declarations
 void load_initial_firmware(void);
-void load_firmware(void);
-void boot_firmware(void);
-long program_flash(uint32_t, unsigned char *, unsigned int);
-bool verify_frame(unsigned char *frame_data, int frame_len, unsigned char *hashed_checksum);
-unsigned char* decrypt_aes(unsigned char* data, unsigned char* nonce, unsigned char* tag);
-
-// Firmware Constants
-#define METADATA_BASE 0xFC00 // base address of version and firmware size in Flash
-#define FW_BASE 0x10000      // base address of firmware in Flash
-
-// FLASH Constants
-#define FLASH_PAGESIZE 1024
-#define FLASH_WRITESIZE 4
-#define MAX_FW 15000
-
-// Protocol Constants
-#define OK ((unsigned char)0x00)
-#define ERROR ((unsigned char)0x01)
-#define UPDATE ((unsigned char)'U')
-#define BOOT ((unsigned char)'B')
+RAMFUNC long program_word(uint32_t addr, uint32_t word);
+RAMFUNC void uart1_rx_isr(void);
+RAMFUNC void uart2_rx_isr(void);
+RAMFUNC uint8_t rx_byte(void);
+void poll_events(void);
+uint32_t mailbox_take(void);
+void mem_report(void);
+void uart_write_u32(uint8_t uart, uint32_t value);
+unsigned long StackHighWater(void); // startup_gcc.c
+unsigned long StackSize(void);
+#ifdef CRYPTO_BENCH
+void crypto_bench(void);
+#endif
+
+// Flash region of each component id, in id order
+const comp_region_t comp_regions[COMP_COUNT] = {
+    {FW_BASE, MAX_FW},
+    {MSG_BASE, MAX_MSG},
+    {CONFIG_BASE, MAX_CONFIG},
+};
+
+// gcmkey's round keys and GHASH key, expanded by bl_build.py. decrypt_aes()
+// runs straight from these, so no chunk pays for a key schedule.
+#if defined(AES_CM3) || defined(CRYPTO_BENCH)
+static const uint32_t gcm_round_keys[44] = GCM_ROUND_KEYS;
+static const uint32_t gcm_htab[16][4] = GCM_HTAB;
+#endif
+#ifndef AES_CM3
+static const br_aes_big_ctr_keys gcm_aes_keys = {&br_aes_big_ctr_vtable, GCM_ROUND_KEYS, 10};
+static const unsigned char gcm_h[16] = GCM_H;
+#endif
+
+bool header_reject(uint32_t cause, const char *why);
+void comp_report(void);
+void device_report(void);
+void page_hashes(const uint8_t *data, uint32_t size, manifest_t *manifest);
+bool verify_boot_image(void);
+void stats_load(void);
+void stats_report(void);
 
 // Firmware v2 is embedded in bootloader
 // Read up on these symbols in the objcopy man page (if you want)!
@@ -62,11 +93,40 @@ extern int _binary_firmware_bin_start;
 extern int _binary_firmware_bin_size;
 
 // Device metadata
-uint16_t *fw_version_address = (uint16_t *)METADATA_BASE;
-uint16_t *fw_size_address = (uint16_t *)(METADATA_BASE + 2);
-uint8_t *fw_release_message_address;
+const comp_table_t *comp_table = (const comp_table_t *)METADATA_BASE;
 void uart_write_hex_bytes(uint8_t uart, uint8_t *start, uint32_t len);
 
+static int clock_profile = CLOCK_PROFILE_DEFAULT; // last clock_set_profile()
+static uint32_t reset_cause;
+uint32_t updates_installed;
+
+// Statistics, loaded at reset and saved after every change of note
+update_stats_t stats;
+uint64_t update_cycles; // SysTick cycles since the update started
+uint32_t update_tick;   // SysTick value at the last stats_clock()
+uint32_t header_fail;   // STAT_FAIL_* cause given to the last header_reject()
+
+// Host receive rings. UART2 only carries host bytes during a striped update.
+volatile uint8_t rx_ring[RX_RING_SIZE];
+volatile uint32_t rx_head = 0;
+volatile uint32_t rx_tail = 0;
+volatile uint8_t rx2_ring[RX_RING_SIZE];
+volatile uint32_t rx2_head = 0;
+volatile uint32_t rx2_tail = 0;
+
+// Host commands, outside an update. The other tasks are in update.c.
+void cmd_task_run(void);
+static task_t cmd_task = {"command", cmd_task_run};
+
+static uint32_t tick_mark;   // SysTick value at the last tick
+static uint32_t tick_cycles; // core clocks per millisecond
+
+// SysCtlClockSet configuration for each clock profile
+static const unsigned long clock_profiles[] = {
+    SYSCTL_SYSDIV_1 | SYSCTL_USE_OSC | SYSCTL_OSC_MAIN | SYSCTL_XTAL_8MHZ,
+    SYSCTL_SYSDIV_4 | SYSCTL_USE_PLL | SYSCTL_OSC_MAIN | SYSCTL_XTAL_8MHZ,
+};
+
 // Firmware Buffer
 
 int main(void)
@@ -82,32 +142,158 @@ int main(void)
     uart_init(UART1);
     uart_init(UART2);
 
+    // Passed on to the firmware; cleared so the next reset reports only its own cause
+    reset_cause = SysCtlResetCauseGet();
+    SysCtlResetCauseClear(reset_cause);
+
+    // Free-running SysTick for cycle measurements
+    SysTickPeriodSet(0x1000000);
+    SysTickEnable();
+    trace_init();
+    crc32_init();
+
     // Enable UART0 interrupt
     IntEnable(INT_UART0);
+
+    // Host bytes are taken by a RAM-resident ISR so reception continues while
+    // flash is erased or programmed. IntRegister also moves the vector table
+    // to SRAM, so dispatching the interrupt does not touch flash either.
+    IntRegister(INT_UART1, uart1_rx_isr);
+    HWREG(UART1_BASE + UART_O_IM) |= UART_IM_RXIM | UART_IM_RTIM;
+    IntEnable(INT_UART1);
+    IntRegister(INT_UART2, uart2_rx_isr); // enabled by stripe_enable()
     IntMasterEnable();
 
+    stats_load();
     load_initial_firmware(); // note the short-circuit behavior in this function, it doesn't finish running on reset!
 
-    uart_write_str(UART2, "Welcome to the BWSI Vehicle Update Service!\n");
-    uart_write_str(UART2, "Send \"U\" to update, and \"B\" to run the firmware.\n");
-    uart_write_str(UART2, "Writing 0x20 to UART0 will reset the device.\n");
+#ifdef CRYPTO_BENCH
+    crypto_bench();
+#endif
+
+    // The firmware may have asked for this reset
+    uint32_t request = mailbox_take();
+    if (request == MAILBOX_REQ_BOOT)
+    {
+        boot_firmware(); // Returns only if the firmware cannot be started
+    }
+    if (request != MAILBOX_REQ_UPDATE)
+    {
+        uart_write_str(UART2, "Welcome to the BWSI Vehicle Update Service!\n");
+        uart_write_str(UART2, "Send \"U\" to update, and \"B\" to run the firmware.\n");
+        uart_write_str(UART2, "Writing 0x20 to UART0 will reset the device.\n");
+    }
+
+    // Everything from here on is a task, run when an event signals it
+    sched_add(&cmd_task);
+    sched_add(&rx_task);
+    sched_add(&crypto_task);
+    sched_add(&flash_task);
+    sched_add(&tick_task);
+    sched_add(&diag_task);
+    sched_add(&log_task);
+    tick_cycles = SysCtlClockGet() / 1000;
+    tick_mark = SysTickValueGet();
+
+    if (request == MAILBOX_REQ_UPDATE)
+    {
+        // No banner and no 'U' from the host: the update starts now and is
+        // announced with the "U" the host would otherwise have asked for
+        clock_set_profile(UPDATE_CLOCK_PROFILE);
+        mailbox_post(MAILBOX_REQ_NONE, MAILBOX_STATUS_RUNNING, 0, 0);
+        uart_write_str(UART1, "U");
+        update_start(1);
+        engine.requested = true;
+    }
 
-    int resp;
     while (1)
     {
-        uint32_t instruction = uart_read(UART1, BLOCKING, &resp);
-        if (instruction == UPDATE)
-        {
-            uart_write_str(UART1, "U");
-            load_firmware();
-            uart_write_str(UART2, "Loaded new firmware.\n");
-            nl(UART2);
-        }
-        else if (instruction == BOOT)
-        {
-            uart_write_str(UART1, "B");
-            boot_firmware();
-        }
+        poll_events();
+        sched_run();
+    }
+}
+
+/*
+ * Turn hardware state into task signals: bytes from the host, a byte on
+ * UART2 and the passing of each millisecond.
+ */
+void poll_events(void)
+{
+    if (rx_head != rx_tail)
+    {
+        sched_signal(engine.active ? &rx_task : &cmd_task);
+    }
+    if (rx2_head != rx2_tail)
+    {
+        sched_signal(&rx_task);
+    }
+    if (!(engine.active && engine.link_count > 1) && !(HWREG(UART2_BASE + UART_O_FR) & UART_FR_RXFE))
+    {
+        sched_signal(&diag_task); // UART2 bytes are the host's during a striped update
+    }
+    if (cycles_since(tick_mark) >= tick_cycles)
+    {
+        tick_mark = SysTickValueGet();
+        sched_signal(&tick_task);
+    }
+}
+
+/*
+ * Outside an update, host bytes are commands.
+ */
+void cmd_task_run(void)
+{
+    if (engine.active || rx_head == rx_tail)
+    {
+        return;
+    }
+
+    uint32_t instruction = rx_byte();
+    if (instruction == UPDATE)
+    {
+        // Switch before answering: the host sends nothing until it sees "U"
+        clock_set_profile(UPDATE_CLOCK_PROFILE);
+        uart_write_str(UART1, "U");
+        update_start(1);
+    }
+    else if (instruction == STRIPED_UPDATE)
+    {
+        // As UPDATE, but the frames come over UART1 and UART2 in turn. UART2
+        // takes host bytes from before the answer on.
+        clock_set_profile(UPDATE_CLOCK_PROFILE);
+        stripe_enable(true);
+        uart_write_str(UART1, "W");
+        update_start(RX_LINKS);
+    }
+    else if (instruction == BOOT)
+    {
+        uart_write_str(UART1, "B");
+        boot_firmware();
+    }
+    else if (instruction == MEM_REPORT)
+    {
+        uart_write_str(UART1, "M");
+        mem_report();
+    }
+    else if (instruction == COMP_QUERY)
+    {
+        uart_write_str(UART1, "C");
+        comp_report();
+    }
+    else if (instruction == STATS_QUERY)
+    {
+        uart_write_str(UART1, "S");
+        stats_report();
+    }
+    else if (instruction == TRACE_DUMP)
+    {
+        uart_write_str(UART1, "T");
+        trace_dump();
+    }
+    else if (instruction == DEVICE_QUERY)
+    {
+        uart_write_str(UART1, "Q");
+        device_report();
     }
 }
 
@@ -127,187 +313,540 @@ void load_initial_firmware(void)
         return;
     }
 
-    // Create buffers for saving the release message
-    uint8_t temp_buf[FLASH_PAGESIZE];
     char initial_msg[] = "This is the initial release message.";
-    uint16_t msg_len = strlen(initial_msg) + 1;
-    uint16_t rem_msg_bytes;
+    uint32_t msg_len = strlen(initial_msg) + 1;
+    uint8_t digest[DIGEST_SIZE];
 
     // Get included initial firmware
     int size = (int)&_binary_firmware_bin_size;
     uint8_t *initial_data = (uint8_t *)&_binary_firmware_bin_start;
 
-    // Set version 2 and install
-    uint16_t version = 2;
-    uint32_t metadata = (((uint16_t)size & 0xFFFF) << 16) | (version & 0xFFFF);
-    program_flash(METADATA_BASE, (uint8_t *)(&metadata), 4);
+    for (int i = 0; i * FLASH_PAGESIZE < size; i++)
+    {
+        int len = size - (i * FLASH_PAGESIZE);
+        program_flash(FW_BASE + (i * FLASH_PAGESIZE), initial_data + (i * FLASH_PAGESIZE), len < FLASH_PAGESIZE ? len : FLASH_PAGESIZE);
+    }
+
+    // The release message has its own page
+    program_flash(MSG_BASE, (uint8_t *)initial_msg, msg_len);
 
-    int i;
+    // Set version 2 for both and record them in the component table
+    uint32_t mark = arena_mark();
+    comp_table_t *table = arena_alloc(sizeof(*table));
+    manifest_t *manifest = arena_alloc(sizeof(*manifest));
+    bool ok = table != NULL && manifest != NULL;
 
-    for (i = 0; i < size / FLASH_PAGESIZE; i++)
+    if (ok)
     {
-        program_flash(FW_BASE + (i * FLASH_PAGESIZE), initial_data + (i * FLASH_PAGESIZE), FLASH_PAGESIZE);
+        table_load(table);
+        page_hashes(initial_data, size, manifest);
+        program_flash(MANIFEST_BASE, (uint8_t *)manifest, sizeof(*manifest));
+        ok = merkle_root(manifest->leaves[0], manifest->leaf_count, digest);
+        table_set(table, COMP_FIRMWARE, 2, size, digest);
+        page_hashes((uint8_t *)initial_msg, msg_len, manifest);
+        ok = merkle_root(manifest->leaves[0], manifest->leaf_count, digest) && ok;
+        table_set(table, COMP_MESSAGE, 2, msg_len, digest);
     }
 
-    /* At end of firmware. Since the last page may be incomplete, we copy the initial
-     * release message into the unused space in the last page. If the firmware fully
-     * uses the last page, the release message simply is written to a new page.
-     */
-
-    uint16_t rem_fw_bytes = size % FLASH_PAGESIZE;
-    if (rem_fw_bytes == 0)
+    // Without the table nothing counts as installed and the next reset
+    // loads the initial firmware again
+    if (ok)
     {
-        // No firmware left. Just write the release message
-        program_flash(FW_BASE + (i * FLASH_PAGESIZE), (uint8_t *)initial_msg, msg_len);
+        program_flash(METADATA_BASE, (uint8_t *)table, sizeof(*table));
     }
     else
     {
-        // Some firmware left. Determine how many bytes of release message can fit
-        if (msg_len > (FLASH_PAGESIZE - rem_fw_bytes))
-        {
-            rem_msg_bytes = msg_len - (FLASH_PAGESIZE - rem_fw_bytes);
-        }
-        else
+        uart_write_str(UART2, "Initial firmware: out of arena memory\n");
+    }
+    arena_release(mark);
+    stats_save();
+}
+
+/*
+ * Find the descriptor for a component id in an authenticated package.
+ */
+const comp_desc_t *find_desc(const package_t *pkg, uint32_t id)
+{
+    for (int i = 0; i < pkg->header.comp_count; i++)
+    {
+        if (pkg->comps[i].id == id)
         {
-            rem_msg_bytes = 0;
+            return &pkg->comps[i];
         }
+    }
+    return NULL;
+}
+
+/*
+ * Copy the component table out of flash, or start an empty one if the
+ * metadata page does not hold a table yet.
+ */
+void table_load(comp_table_t *table)
+{
+    if (comp_table->magic == TABLE_MAGIC)
+    {
+        memcpy(table, comp_table, sizeof(*table));
+        return;
+    }
+
+    memset(table, 0, sizeof(*table));
+    table->magic = TABLE_MAGIC;
+    for (int id = 0; id < COMP_COUNT; id++)
+    {
+        table->comps[id].id = id;
+        table->comps[id].addr = comp_regions[id].base;
+    }
+}
+
+/*
+ * Record a component in the RAM copy of the table. A size of 0 marks it as
+ * not installed. The caller programs the table back to flash.
+ */
+void table_set(comp_table_t *table, uint16_t id, uint16_t version, uint32_t size, const uint8_t *digest)
+{
+    comp_entry_t *entry = &table->comps[id];
+
+    entry->version = version;
+    entry->size = size;
+    if (digest != NULL)
+    {
+        memcpy(entry->digest, digest, DIGEST_SIZE);
+    }
+    else
+    {
+        memset(entry->digest, 0, DIGEST_SIZE);
+    }
+
+    if (id == COMP_FIRMWARE)
+    {
+        table->fw_version = version;
+        table->fw_size = size & 0xFFFF;
+    }
+}
+
+/*
+ * Send the component table to the host: one comp_entry_t per known component
+ * (id, version, size, address, digest; little-endian), so it can skip
+ * components that are already installed.
+ */
+void comp_report(void)
+{
+    uint32_t mark = arena_mark();
+    comp_table_t *table = arena_alloc(sizeof(*table));
+
+    if (table == NULL)
+    {
+        return; // the host times out waiting for the table
+    }
+    table_load(table);
+    for (uint32_t i = 0; i < sizeof(table->comps); i++)
+    {
+        uart_write(UART1, ((uint8_t *)table->comps)[i]);
+    }
+    arena_release(mark);
+}
+
+/*
+ * Switch the system clock to a profile and recompute everything derived from
+ * it: the UART baud divisors and the flash controller's microsecond count.
+ */
+void clock_set_profile(int profile)
+{
+    // Let queued output go out at the old baud rate first
+    while (UARTBusy(UART0_BASE) || UARTBusy(UART1_BASE) || UARTBusy(UART2_BASE))
+    {
+    }
+
+    SysCtlClockSet(clock_profiles[profile]);
+    clock_profile = profile;
+
+    unsigned long hz = SysCtlClockGet();
+    FlashUsecSet(hz / 1000000);
+    tick_cycles = hz / 1000;
+    UARTConfigSetExpClk(UART0_BASE, hz, UART_BAUD, UART_CONFIG_WLEN_8 | UART_CONFIG_STOP_ONE | UART_CONFIG_PAR_NONE);
+    UARTConfigSetExpClk(UART1_BASE, hz, UART_BAUD, UART_CONFIG_WLEN_8 | UART_CONFIG_STOP_ONE | UART_CONFIG_PAR_NONE);
+    UARTConfigSetExpClk(UART2_BASE, hz, UART_BAUD, UART_CONFIG_WLEN_8 | UART_CONFIG_STOP_ONE | UART_CONFIG_PAR_NONE);
+    trace(TRACE_CLOCK, profile, hz);
+}
+
+/*
+ * CPU cycles elapsed since a SysTickValueGet() reading (SysTick counts down
+ * from 2^24 - 1 at the core clock).
+ */
+uint32_t cycles_since(uint32_t start)
+{
+    return (start - SysTickValueGet()) & 0xFFFFFF;
+}
+
+/*
+ * Tell the host what this device runs and accepts: a device_info_t, the
+ * component table entries and each component's capacity. The host skips an
+ * update the device already has and sizes its frames from this.
+ */
+void device_report(void)
+{
+    uint32_t mark = arena_mark();
+    comp_table_t *table = arena_alloc(sizeof(*table));
+    device_info_t *info = arena_alloc(sizeof(*info));
+
+    if (table == NULL || info == NULL)
+    {
+        arena_release(mark);
+        return; // the host times out waiting for the answer
+    }
+    table_load(table);
+    memset(info, 0, sizeof(*info));
+    info->magic = DEVICE_MAGIC;
+    info->format = PKG_FORMAT;
+    info->max_frame = FRAME_SIZE;
+    info->chunk_size = FLASH_PAGESIZE;
+    info->comp_count = COMP_COUNT;
+    info->features = FEATURE_PARTIAL | FEATURE_STATS | FEATURE_CRC32 | FEATURE_STRIPE;
+#if TRACE_ENTRIES > 0
+    info->features |= FEATURE_TRACE;
+#endif
+    info->device_id = device_id;
+    for (int id = 0; id < COMP_COUNT; id++)
+    {
+        info->free_flash += comp_regions[id].max_size - table->comps[id].size;
+    }
+
+    for (uint32_t i = 0; i < sizeof(*info); i++)
+    {
+        uart_write(UART1, ((uint8_t *)info)[i]);
+    }
+    for (uint32_t i = 0; i < sizeof(table->comps); i++)
+    {
+        uart_write(UART1, ((uint8_t *)table->comps)[i]);
+    }
+    for (int id = 0; id < COMP_COUNT; id++)
+    {
+        uart_write_u32(UART1, comp_regions[id].max_size);
+    }
+    arena_release(mark);
+}
+
+/*
+ * Report peak stack and arena use since reset. The host gets four
+ * little-endian words on UART1: stack used, stack size, arena used, arena
+ * size (all in bytes); the same figures are printed on UART2.
+ */
+void mem_report(void)
+{
+    uint32_t stack_used = StackHighWater();
+    uint32_t stack_size = StackSize();
+
+    uart_write_u32(UART1, stack_used);
+    uart_write_u32(UART1, stack_size);
+    uart_write_u32(UART1, arena_peak());
+    uart_write_u32(UART1, ARENA_SIZE);
+
+    uart_write_str(UART2, "Stack high water: ");
+    uart_write_dec(UART2, stack_used);
+    uart_write_str(UART2, " / ");
+    uart_write_dec(UART2, stack_size);
+    uart_write_str(UART2, " bytes\nArena high water: ");
+    uart_write_dec(UART2, arena_peak());
+    uart_write_str(UART2, " / ");
+    uart_write_dec(UART2, ARENA_SIZE);
+    uart_write_str(UART2, " bytes\n");
+}
+
+/*
+ * Write a 32 bit value as four little-endian bytes.
+ */
+void uart_write_u32(uint8_t uart, uint32_t value)
+{
+    for (int i = 0; i < 4; i++)
+    {
+        uart_write(uart, (value >> (8 * i)) & 0xFF);
+    }
+}
+
+/*
+ * UART1 receive interrupt: drain the FIFO into the ring. Touches registers
+ * only, so it never calls into flash.
+ */
+RAMFUNC void uart1_rx_isr(void)
+{
+    HWREG(UART1_BASE + UART_O_ICR) = UART_ICR_RXIC | UART_ICR_RTIC;
+    while (!(HWREG(UART1_BASE + UART_O_FR) & UART_FR_RXFE))
+    {
+        rx_ring[rx_head] = (uint8_t)HWREG(UART1_BASE + UART_O_DR);
+        rx_head = (rx_head + 1) & (RX_RING_SIZE - 1);
+    }
+}
 
-        // Copy rest of firmware
-        memcpy(temp_buf, initial_data + (i * FLASH_PAGESIZE), rem_fw_bytes);
-        // Copy what will fit of the release message
-        memcpy(temp_buf + rem_fw_bytes, initial_msg, msg_len - rem_msg_bytes);
-        // Program the final firmware and first part of the release message
-        program_flash(FW_BASE + (i * FLASH_PAGESIZE), temp_buf, rem_fw_bytes + (msg_len - rem_msg_bytes));
+/*
+ * UART2 receive interrupt, the same for the second link of a striped update.
+ */
+RAMFUNC void uart2_rx_isr(void)
+{
+    HWREG(UART2_BASE + UART_O_ICR) = UART_ICR_RXIC | UART_ICR_RTIC;
+    while (!(HWREG(UART2_BASE + UART_O_FR) & UART_FR_RXFE))
+    {
+        rx2_ring[rx2_head] = (uint8_t)HWREG(UART2_BASE + UART_O_DR);
+        rx2_head = (rx2_head + 1) & (RX_RING_SIZE - 1);
+    }
+}
 
-        // If there are more bytes, program them directly from the release message string
-        if (rem_msg_bytes > 0)
+/*
+ * Hand UART2's receive side to the host for a striped update, or back to
+ * the diag task. Bytes that came before the handover are not the host's.
+ */
+void stripe_enable(bool on)
+{
+    if (on)
+    {
+        while (!(HWREG(UART2_BASE + UART_O_FR) & UART_FR_RXFE))
         {
-            // Writing to a new page. Increment pointer
-            i++;
-            program_flash(FW_BASE + (i * FLASH_PAGESIZE), (uint8_t *)(initial_msg + (msg_len - rem_msg_bytes)), rem_msg_bytes);
+            (void)HWREG(UART2_BASE + UART_O_DR);
         }
+        rx2_head = rx2_tail = 0;
+        HWREG(UART2_BASE + UART_O_IM) |= UART_IM_RXIM | UART_IM_RTIM;
+        IntEnable(INT_UART2);
+    }
+    else
+    {
+        IntDisable(INT_UART2);
+        HWREG(UART2_BASE + UART_O_IM) &= ~(UART_IM_RXIM | UART_IM_RTIM);
     }
 }
 
 /*
- * Load the firmware into flash.
+ * Take one byte from the host, waiting for it if needed.
  */
-void load_firmware(void)
+RAMFUNC uint8_t rx_byte(void)
 {
-    int frame_length = 0;
-    int read = 0;
-    uint32_t rcv = 0;
+    while (rx_head == rx_tail)
+    {
+    }
+    uint8_t c = rx_ring[rx_tail];
+    rx_tail = (rx_tail + 1) & (RX_RING_SIZE - 1);
+    return c;
+}
 
-    uint32_t data_index = 0;
-    uint32_t page_addr = FW_BASE;
-    uint32_t version = 0;
-    uint32_t size = 0;
+/*
+ * Return the firmware's request and clear it, so it is acted on once even
+ * if the device resets during the update. MAILBOX_REQ_NONE if the block is
+ * not valid.
+ */
+uint32_t mailbox_take(void)
+{
+    mailbox_t *mailbox = (mailbox_t *)MAILBOX_BASE;
 
-    // Get size as 2 bytes
-    rcv = uart_read(UART1, BLOCKING, &read);
-    size = (uint32_t)rcv;
-    rcv = uart_read(UART1, BLOCKING, &read);
-    size |= (uint32_t)rcv << 8;
-    if(size>MAX_FW){
-        uart_write(UART1, ERROR); // Reject the metadata.
-        SysCtlReset();            // Reset device
-        return;
+    if (mailbox->magic != MAILBOX_MAGIC ||
+        mailbox->check != ~(mailbox->request ^ mailbox->status ^ mailbox->cause ^ mailbox->installed))
+    {
+        return MAILBOX_REQ_NONE;
     }
-    unsigned char data[size];
+    uint32_t request = mailbox->request;
+    mailbox_post(MAILBOX_REQ_NONE, mailbox->status, mailbox->cause, mailbox->installed);
+    return request;
+}
 
-    uart_write_str(UART0, "Received Firmware Size: ");
-    uart_write_hex(UART0, size);
-    nl(UART0);
+void mailbox_post(uint32_t request, uint32_t status, uint32_t cause, uint32_t installed)
+{
+    mailbox_t *mailbox = (mailbox_t *)MAILBOX_BASE;
 
-    unsigned char gcm_nonce[16];
-    unsigned char tag[16];
+    mailbox->request = request;
+    mailbox->status = status;
+    mailbox->cause = cause;
+    mailbox->installed = installed;
+    mailbox->check = ~(request ^ status ^ cause ^ installed);
+    mailbox->magic = MAILBOX_MAGIC;
+}
 
-    for (int i = 0; i < 16; i++)
+/*
+ * Root of the Merkle tree over count page hashes: each level hashes pairs of
+ * nodes, and an odd node out moves up unchanged. One page is its own root.
+ * Must match merkle_root() in tools/fw_protect.py. False, with no root, if
+ * the arena cannot hold the work.
+ */
+bool merkle_root(const uint8_t *leaves, uint32_t count, uint8_t *root)
+{
+    uint32_t mark = arena_mark();
+    br_sha256_context *sha_ctx = arena_alloc(sizeof(*sha_ctx));
+    uint8_t (*level)[DIGEST_SIZE] = arena_alloc(count * DIGEST_SIZE);
+
+    if (sha_ctx == NULL || level == NULL)
     {
-        gcm_nonce[i] = uart_read(UART1, BLOCKING, &read);
+        arena_release(mark);
+        return false;
     }
-    for (int i = 0; i < 16; i++)
+    memcpy(level, leaves, count * DIGEST_SIZE);
+    while (count > 1)
     {
-        tag[i] = uart_read(UART1, BLOCKING, &read);
+        for (uint32_t i = 0; i < count / 2; i++)
+        {
+            br_sha256_init(sha_ctx);
+            br_sha256_update(sha_ctx, level[2 * i], 2 * DIGEST_SIZE);
+            br_sha256_out(sha_ctx, level[i]);
+        }
+        if (count % 2)
+        {
+            memcpy(level[count / 2], level[count - 1], DIGEST_SIZE);
+        }
+        count = (count + 1) / 2;
     }
+    memcpy(root, level[0], DIGEST_SIZE);
+    arena_release(mark);
+    return true;
+}
 
-    uart_write_str(UART0, "Received nonce+tag");
-    nl(UART0);
+/*
+ * Fill a manifest with the SHA-256 of each page of data.
+ */
+void page_hashes(const uint8_t *data, uint32_t size, manifest_t *manifest)
+{
+    manifest->magic = MANIFEST_MAGIC;
+    manifest->leaf_count = (size + FLASH_PAGESIZE - 1) / FLASH_PAGESIZE;
+    for (uint32_t i = 0; i < manifest->leaf_count; i++)
+    {
+        uint32_t len = size - (i * FLASH_PAGESIZE);
+        sha_hash((unsigned char *)data + (i * FLASH_PAGESIZE), len < FLASH_PAGESIZE ? len : FLASH_PAGESIZE, manifest->leaves[i]);
+    }
+}
 
-    // Write new firmware size and version to Flash
-    // Create 32 bit word for flash programming, version is at lower address, size is at higher address
-    uint32_t metadata = ((size & 0xFFFF) << 16) | (version & 0xFFFF);
-    program_flash(METADATA_BASE, (uint8_t *)(&metadata), 4);
+/*
+ * Check the installed firmware before it is started, without hashing the
+ * whole image on every boot. The manifest's root must match the digest in
+ * the component table (cheap: one hash per tree node). Then up to
+ * BOOT_VERIFY_PAGES pages that have not been checked since the image was
+ * installed are hashed and compared with the manifest, and their bits in
+ * MANIFEST_PENDING are cleared, so after a few boots only the root check is
+ * left.
+ */
+bool verify_boot_image(void)
+{
+    const manifest_t *manifest = (const manifest_t *)MANIFEST_BASE;
+    const comp_entry_t *fw = &comp_table->comps[COMP_FIRMWARE];
+    uint32_t pages = (fw->size + FLASH_PAGESIZE - 1) / FLASH_PAGESIZE;
+    uint8_t digest[DIGEST_SIZE];
+    uint8_t diff = 0;
 
-    uart_write(UART1, OK); // Acknowledge the metadata.
+    if (manifest->magic != MANIFEST_MAGIC || manifest->leaf_count != pages)
+    {
+        return false;
+    }
 
-    /* Loop here until you can get all your characters and stuff */
-    while (1)
+    if (!merkle_root(manifest->leaves[0], pages, digest))
+    {
+        return false;
+    }
+    for (int j = 0; j < DIGEST_SIZE; j++)
+    {
+        diff |= digest[j] ^ fw->digest[j];
+    }
+    if (diff != 0)
     {
-        // Get start frame endian short
-        rcv = uart_read(UART1, BLOCKING, &read);
-        int start_short = (int)rcv;
-        rcv = uart_read(UART1, BLOCKING, &read);
-        start_short |= (int)rcv << 8;
+        return false;
+    }
+
+    uint32_t pending = HWREG(MANIFEST_PENDING);
+    uint32_t checked = pending;
+    uint32_t budget = BOOT_VERIFY_PAGES;
+    for (uint32_t i = 0; i < pages && (BOOT_VERIFY_PAGES == 0 || budget > 0); i++)
+    {
+        if (!(pending & (1u << i)))
+        {
+            continue;
+        }
 
-        if (start_short != 1)
+        uint32_t len = fw->size - (i * FLASH_PAGESIZE);
+        sha_hash((unsigned char *)(fw->addr + (i * FLASH_PAGESIZE)), len < FLASH_PAGESIZE ? len : FLASH_PAGESIZE, digest);
+        for (int j = 0; j < DIGEST_SIZE; j++)
         {
-            uart_write(UART1, ERROR); // Reject the metadata.
-            SysCtlReset();            // Reset device
-            return;
+            diff |= digest[j] ^ manifest->leaves[i][j];
         }
-        
-        uart_write_str(UART0, "receiving data");
-        nl(UART0);
-        // Get two bytes for the length.
-        rcv = uart_read(UART1, BLOCKING, &read);
-        frame_length = (int)rcv << 8;
-        rcv = uart_read(UART1, BLOCKING, &read);
-        frame_length += (int)rcv;
-        if (frame_length == 0)
+        if (diff != 0)
         {
-            uart_write_str(UART0, "finished receiving data");
-            nl(UART0);
-            uart_write(UART1, OK); // Acknowledge the frame.
-            break;
+            return false;
         }
-        unsigned char tempdata[frame_length];
-        // Get the 256 length data
-        for (int i = 0; i < frame_length; i++)
+        checked &= ~(1u << i);
+        budget--;
+    }
+
+    // Only ever clears bits, so the word is programmed without an erase
+    if (checked != pending)
+    {
+        program_word(MANIFEST_PENDING, checked);
+    }
+    return true;
+}
+
+/*
+ * First look at a package header, before its descriptors are read.
+ */
+bool check_header_prefix(const pkg_header_t *header)
+{
+    if (header->magic != PKG_MAGIC || header->format != PKG_FORMAT)
+    {
+        return header_reject(STAT_FAIL_FORMAT, "unknown package format");
+    }
+    if (header->device_id != device_id)
+    {
+        return header_reject(STAT_FAIL_DEVICE, "package is for another device");
+    }
+    if (header->chunk_size != FLASH_PAGESIZE || header->comp_count == 0 || header->comp_count > MAX_COMPONENTS)
+    {
+        return header_reject(STAT_FAIL_FORMAT, "bad package layout");
+    }
+    return true;
+}
+
+/*
+ * Check every component descriptor against its flash region and the
+ * installed version, then authenticate the header and descriptors. The
+ * plaintext checks come first since they cost nothing; a package only
+ * passes once the tag matches as well.
+ */
+bool check_header(const package_t *pkg, const comp_table_t *table, const unsigned char *tag)
+{
+    uint32_t seen = 0;
+    for (int i = 0; i < pkg->header.comp_count; i++)
+    {
+        const comp_desc_t *desc = &pkg->comps[i];
+        if (desc->id >= COMP_COUNT || (seen & (1u << desc->id)))
         {
-            data[data_index] = uart_read(UART1, BLOCKING, &read);
-            tempdata[i] = data[data_index];
-            if (data_index >= sizeof(data))
-            {
-                uart_write(UART1, ERROR); // Reject the metadata.
-                SysCtlReset();            // Reset device
-                return;
-            }
-            data_index += 1;
+            return header_reject(STAT_FAIL_FORMAT, "bad component id");
         }
-        unsigned char checksums[32];
-        // Get the 32 length checksum
-        for (int i = 0; i < 32; i++)
+        seen |= 1u << desc->id;
+
+        if (desc->size == 0 || desc->size > comp_regions[desc->id].max_size)
         {
-            checksums[i] = uart_read(UART1, BLOCKING, &read);
+            return header_reject(STAT_FAIL_FORMAT, "component too large");
         }
-        
-        bool verified = verify_frame(tempdata, 256, checksums);
-        if (verified)
+        if (desc->chunk_count != (desc->size + FLASH_PAGESIZE - 1) / FLASH_PAGESIZE)
         {
-            uart_write(UART1, OK); // Acknowledge the frame.
+            return header_reject(STAT_FAIL_FORMAT, "bad package layout");
         }
-        else
+
+        // Version 0 is a debug build and may be installed over anything
+        if (desc->version != 0 && desc->version < table->comps[desc->id].version)
         {
-            uart_write(UART1, ERROR); // Reject the metadata.
-            SysCtlReset();            // Reset device
-            return;
+            return header_reject(STAT_FAIL_DOWNGRADE, "downgrade");
         }
     }
-    uart_write_str(UART0, "starting decrypt");
-    nl(UART0);
-    unsigned char* unencrypted_data = decrypt_aes(data,gcm_nonce,tag);
-    // decrypt and load raw data into flash
+
+    if (!decrypt_aes(pkg, HEADER_NONCE_INDEX, NULL, 0, tag))
+    {
+        return header_reject(STAT_FAIL_AUTH, "header authentication failed");
+    }
+    return true;
+}
+
+/*
+ * Say on UART2 why a package header was turned away, and keep the cause for
+ * the statistics.
+ */
+bool header_reject(uint32_t cause, const char *why)
+{
+    header_fail = cause;
+    uart_write_str(UART2, "Rejected package: ");
+    uart_write_str(UART2, (char *)why);
+    nl(UART2);
+    return false;
 }
 
 /*
@@ -317,63 +856,225 @@ void load_firmware(void)
  *
  * This functions performs an erase of the specified flash page before writing
  * the data.
+ *
+ * Runs from SRAM and drives the flash controller registers directly rather
+ * than through driverlib's FlashErase/FlashProgram (which live in flash), so
+ * the UART1 ISR keeps draining the host link while each operation completes.
+ * The erase is counted in the RAM statistics; stats_save() makes it stick.
+ */
+RAMFUNC long program_flash(uint32_t page_addr, unsigned char *data, unsigned int data_len)
+{
+    erase_page(page_addr, 0);
+    return write_page(page_addr, data, data_len);
+}
+
+/*
+ * Erase one flash page. ahead is 1 when the flash task erases the page
+ * before its chunk is ready (it only shows in the trace).
  */
-long program_flash(uint32_t page_addr, unsigned char *data, unsigned int data_len)
+RAMFUNC void erase_page(uint32_t page_addr, uint32_t ahead)
 {
-    uint32_t word = 0;
-    int ret;
-    int i;
+    if (page_addr / FLASH_PAGESIZE < FLASH_PAGES && stats.erase_counts[page_addr / FLASH_PAGESIZE] != 0xFFFF)
+    {
+        stats.erase_counts[page_addr / FLASH_PAGESIZE]++;
+    }
+    trace(TRACE_ERASE, page_addr, ahead);
 
-    // Erase next FLASH page
-    FlashErase(page_addr);
+    // Clear any stale access error
+    HWREG(FLASH_FCMISC) = FLASH_FCMISC_AMISC;
 
-    // Clear potentially unused bytes in last word
-    // If data not a multiple of 4 (word size), program up to the last word
-    // Then create temporary variable to create a full last word
-    if (data_len % FLASH_WRITESIZE)
+    HWREG(FLASH_FMA) = page_addr;
+    HWREG(FLASH_FMC) = FLASH_FMC_WRKEY | FLASH_FMC_ERASE;
+    while (HWREG(FLASH_FMC) & FLASH_FMC_ERASE)
     {
-        // Get number of unused bytes
-        int rem = data_len % FLASH_WRITESIZE;
-        int num_full_bytes = data_len - rem;
+    }
+}
 
-        // Program up to the last word
-        ret = FlashProgram((unsigned long *)data, page_addr, num_full_bytes);
-        if (ret != 0)
+/*
+ * Program data into an erased page.
+ */
+RAMFUNC long write_page(uint32_t page_addr, unsigned char *data, unsigned int data_len)
+{
+    for (unsigned int i = 0; i < data_len; i += FLASH_WRITESIZE)
+    {
+        // Build the word byte by byte; unused bytes in the last word stay 0xFF
+        uint32_t word = 0xFFFFFFFF;
+        for (unsigned int j = 0; j < FLASH_WRITESIZE && i + j < data_len; j++)
         {
-            return ret;
+            word = (word & ~(0xFFu << (8 * j))) | ((uint32_t)data[i + j] << (8 * j));
         }
 
-        // Create last word variable -- fill unused with 0xFF
-        for (i = 0; i < rem; i++)
+        HWREG(FLASH_FMA) = page_addr + i;
+        HWREG(FLASH_FMD) = word;
+        HWREG(FLASH_FMC) = FLASH_FMC_WRKEY | FLASH_FMC_WRITE;
+        while (HWREG(FLASH_FMC) & FLASH_FMC_WRITE)
         {
-            word = (word >> 8) | (data[num_full_bytes + i] << 24); // Essentially a shift register from MSB->LSB
         }
-        for (i = i; i < 4; i++)
+    }
+
+    // Report an access violation the same way FlashProgram does
+    long status = (HWREG(FLASH_FCRIS) & FLASH_FCRIS_ARIS) ? -1 : 0;
+    trace(TRACE_PROGRAM_DONE, page_addr, status);
+    return status;
+}
+
+/*
+ * Program one word without erasing its page. Flash bits only go from 1 to 0
+ * this way, which is all the MANIFEST_PENDING bitmap needs.
+ */
+RAMFUNC long program_word(uint32_t addr, uint32_t word)
+{
+    HWREG(FLASH_FCMISC) = FLASH_FCMISC_AMISC;
+    HWREG(FLASH_FMA) = addr;
+    HWREG(FLASH_FMD) = word;
+    HWREG(FLASH_FMC) = FLASH_FMC_WRKEY | FLASH_FMC_WRITE;
+    while (HWREG(FLASH_FMC) & FLASH_FMC_WRITE)
+    {
+    }
+    return (HWREG(FLASH_FCRIS) & FLASH_FCRIS_ARIS) ? -1 : 0;
+}
+
+/*
+ * Load the newest complete statistics record, or start from zero.
+ */
+void stats_load(void)
+{
+    const update_stats_t *latest = NULL;
+
+    for (int i = 0; i < STATS_PAGES; i++)
+    {
+        const update_stats_t *rec = (const update_stats_t *)(STATS_BASE + (i * FLASH_PAGESIZE));
+        if (rec->magic == STATS_MAGIC && rec->commit == ~rec->seq && (latest == NULL || rec->seq > latest->seq))
         {
-            word = (word >> 8) | 0xFF000000;
+            latest = rec;
         }
+    }
 
-        // Program word
-        return FlashProgram(&word, page_addr + num_full_bytes, 4);
+    if (latest != NULL)
+    {
+        memcpy(&stats, latest, sizeof(stats));
+        return;
     }
-    else
+    memset(&stats, 0, sizeof(stats));
+    stats.magic = STATS_MAGIC;
+}
+
+/*
+ * Write the statistics to the page after the one holding the current record.
+ * The previous record stays intact until this one is complete.
+ */
+void stats_save(void)
+{
+    stats.seq++;
+    stats.commit = ~stats.seq;
+    program_flash(STATS_BASE + ((stats.seq % STATS_PAGES) * FLASH_PAGESIZE), (uint8_t *)&stats, sizeof(stats));
+}
+
+/*
+ * Add the time since the last call to the update's duration. Called at least
+ * once per frame, well within SysTick's 2^24 cycle wrap.
+ */
+void stats_clock(void)
+{
+    update_cycles += cycles_since(update_tick);
+    update_tick = SysTickValueGet();
+}
+
+/*
+ * Send the statistics record to the host as stored (update_stats_t,
+ * little-endian). The firmware reads the same record from STATS_BASE.
+ */
+void stats_report(void)
+{
+    for (uint32_t i = 0; i < sizeof(stats); i++)
     {
-        // Write full buffer of 4-byte words
-        return FlashProgram((unsigned long *)data, page_addr, data_len);
+        uart_write(UART1, ((uint8_t *)&stats)[i]);
     }
 }
 
 void boot_firmware(void)
 {
-    // compute the release message address, and then print it
-    uint16_t fw_size = *fw_size_address;
-    fw_release_message_address = (uint8_t *)(FW_BASE + fw_size);
-    uart_write_str(UART2, (char *)fw_release_message_address);
+    // Start the firmware in a defined clock state
+    clock_set_profile(BOOT_CLOCK_PROFILE);
+    uint32_t boot_start = SysTickValueGet();
+    uint32_t verify_start;
+
+    if (comp_table->magic != TABLE_MAGIC || comp_table->comps[COMP_FIRMWARE].size == 0)
+    {
+        // An update was started but never completed
+        uart_write_str(UART2, "No valid firmware installed.\n");
+        return;
+    }
+    verify_start = SysTickValueGet();
+    if (!verify_boot_image())
+    {
+        uart_write_str(UART2, "Firmware integrity check failed.\n");
+        return;
+    }
+    uint32_t verify_cycles = cycles_since(verify_start);
+
+    // Print the release message, found through the component table
+    const comp_entry_t *msg = &comp_table->comps[COMP_MESSAGE];
+    if (msg->size > 0)
+    {
+        uart_write_str(UART2, (char *)msg->addr);
+    }
+
+    // The image starts with its vector table: initial stack pointer, then
+    // the reset handler, which must lie inside the image
+    const comp_entry_t *fw = &comp_table->comps[COMP_FIRMWARE];
+    const uint32_t *vectors = (const uint32_t *)fw->addr;
+    if (vectors[0] < SRAM_BASE || vectors[0] > HANDOFF_BASE || (vectors[0] & 3) ||
+        !(vectors[1] & 1) || vectors[1] < fw->addr || vectors[1] >= fw->addr + fw->size)
+    {
+        uart_write_str(UART2, "Firmware has no valid vector table.\n");
+        return;
+    }
 
     // Boot the firmware
-    __asm(
-        "LDR R0,=0x10001\n\t"
-        "BX R0\n\t");
+    trace(TRACE_BOOT_FW, fw->version, 0);
+    while (UARTBusy(UART2_BASE))
+    {
+    }
+
+    // Tell it what is already set up, so it can skip doing it again
+    handoff_t *handoff = (handoff_t *)HANDOFF_BASE;
+    memset(handoff, 0, sizeof(*handoff));
+    handoff->version = HANDOFF_VERSION;
+    handoff->size = sizeof(*handoff);
+    handoff->clock_hz = SysCtlClockGet();
+    handoff->clock_config = clock_profiles[clock_profile];
+    handoff->peripherals = HANDOFF_UART0 | HANDOFF_UART1 | HANDOFF_UART2;
+    handoff->uart_baud = UART_BAUD;
+    handoff->reset_cause = reset_cause;
+    handoff->updates = updates_installed;
+    handoff->fw_version = fw->version;
+    handoff->msg_version = msg->version;
+    handoff->fw_size = fw->size;
+    handoff->verify_cycles = verify_cycles;
+    handoff->boot_cycles = cycles_since(boot_start);
+    handoff->magic = HANDOFF_MAGIC;
+
+    // Hand over a quiet core. The UART1 ISR and its ring live in SRAM the
+    // firmware is about to reuse, so UART1 interrupts are switched off and
+    // nothing may stay pending; SysTick goes back to its reset state. UART0
+    // stays enabled, since the firmware's table has the same reset handler.
+    IntMasterDisable();
+    HWREG(UART1_BASE + UART_O_IM) &= ~(UART_IM_RXIM | UART_IM_RTIM);
+    IntDisable(INT_UART1);
+    SysTickDisable();
+    HWREG(NVIC_UNPEND0) = 0xFFFFFFFF;
+    HWREG(NVIC_UNPEND1) = 0xFFFFFFFF;
+
+    // Start it the way the core starts an image at reset: VTOR at its
+    // vector table, MSP from entry 0, then the reset handler from entry 1
+    HWREG(NVIC_VTABLE) = fw->addr;
+    IntMasterEnable();
+    __asm volatile(
+        "MSR MSP, %0\n\t"
+        "BX %1\n\t"
+        :
+        : "r"(vectors[0]), "r"(vectors[1]));
 }
 
 void uart_write_hex_bytes(uint8_t uart, uint8_t *start, uint32_t len)
@@ -408,6 +1109,23 @@ void uart_write_hex_bytes(uint8_t uart, uint8_t *start, uint32_t len)
         uart_write_str(uart, " ");
     }
 }
+/*
+ * Write an unsigned number in decimal.
+ */
+void uart_write_dec(uint8_t uart, uint32_t num)
+{
+    char digits[11];
+    int i = sizeof(digits) - 1;
+
+    digits[i] = '\0';
+    do
+    {
+        digits[--i] = '0' + (num % 10);
+        num /= 10;
+    } while (num > 0);
+    uart_write_str(uart, &digits[i]);
+}
+
 //bytes to hex (?)
 void byteToHexString(unsigned char byte, char* hexString) {
     static const char hexChars[] = "0123456789ABCDEF";
@@ -415,138 +1133,238 @@ void byteToHexString(unsigned char byte, char* hexString) {
     hexString[1] = hexChars[byte & 0xF];
     hexString[2] = '\0'; // Null-terminate the string
 }
-unsigned char* decrypt_aes(unsigned char* data, unsigned char* nonce, unsigned char* tag){
-    
-    /* beaverssl GCM implementation
-    // uart_write_str(UART0, "test1");
-    // nl(UART0);
-    // gcm_decrypt_and_verify(gcmkey, nonce, data, sizeof(data), aad, sizeof(aad), tag);
-    // uart_write_str(UART0, "test1.2");
-    // nl(UART0);
-    */
-     //if(1!=gcm_decrypt_and_verify(gcmkey, nonce, data, strlen(data), aad, strlen(aad), tag)){ //Run gcm decrypt and verify that tag is accurate
-       //  uart_write(UART0, ERROR); // Reject the metadata.
-        // nl(UART0);
-        // SysCtlReset();            // Reset device
-        // return;
-     //}
-       
-    //bearssl gcm implementation
-    //create gcm context, block cipher context with aes-128, ghash
-    br_gcm_context ctx;
-    const br_block_ctr_class* ctrclassptr = &br_aes_big_ctr_vtable;
-    br_ghash ghash;
-
-    // these 2 lines are not needed but I keep them just in case
-    // br_aes_ct_ctr_keys keyctx;
-    // br_aes_ct_ctr_init(&keyctx, gcmkey, len(gcmkey)); 
-
-    //initialize the block cipher context with key
-    ctrclassptr -> init(&ctrclassptr, gcmkey, len(gcmkey));
-    
-    br_gcm_init(&ctx, &ctrclassptr, ghash);
-    br_gcm_reset(&ctx, nonce, len(nonce));
-    br_gcm_aad_inject(&ctx, aad, len(aad));
-    br_gcm_flip(&ctx);
-
-    br_gcm_run(&ctx, 0, data, len(data));
-    //end of br_gcm
-
-    uart_write_str(UART0, "test2");
-    nl(UART0);
-    //Save version and message variables
-    char version[2];
-    for (size_t i = 0; i < 2; i++)
-    {
-        version[i] = data[i];
-    }
-    char msg_size[2];
-    for (size_t i = 0; i < 2; i++)
-    {
-        msg_size[i] = data[i+2];
-    }
-    uint16_t msg_size_int = msg_size[0] + (msg_size[1] << 8);
-    char msg[msg_size_int];
-    for (size_t i = 0; i < msg_size_int; i++)
-    {
-        msg[i] = data[i+2+2];
-    }
-    
-    
-    
-    //AES-CBC
-    char iv_cbc[16];
-    for (size_t i = 0; i < 16; i++)
-    {
-        iv_cbc[i] = iv_cbc[strlen(data)-128-16-32+i];
-    }
-    uart_write_str(UART0, "test3");
-    nl(UART0);
-    aes_decrypt(cbckey, iv_cbc, data, strlen(data));
-    uart_write_str(UART0, "test4");
-    nl(UART0);
-    uart_write_hex(UART0, sizeof(data));
-    return data;
+/*
+ * Verify and decrypt one chunk of a v3 package in place with AES-128-GCM.
+ * The nonce is the header's nonce_base followed by the big-endian nonce index
+ * (see COMP_NONCE_INDEX), and the AAD is the device AAD followed by the header
+ * and its component descriptors, which binds every chunk to its package.
+ * Passing HEADER_NONCE_INDEX with no data checks the header tag. Returns true
+ * only if the tag matches.
+ */
+bool decrypt_aes(const package_t *pkg, uint32_t index, unsigned char *data, uint32_t len, const unsigned char *tag)
+{
+    unsigned char nonce[GCM_NONCE_SIZE];
+    uint32_t header_len = sizeof(pkg->header) + pkg->header.comp_count * sizeof(comp_desc_t);
+
+    memcpy(nonce, pkg->header.nonce_base, sizeof(pkg->header.nonce_base));
+    nonce[8] = (index >> 24) & 0xFF;
+    nonce[9] = (index >> 16) & 0xFF;
+    nonce[10] = (index >> 8) & 0xFF;
+    nonce[11] = index & 0xFF;
+
+    // The GCM state comes from the arena, not the stack
+    uint32_t mark = arena_mark();
+    bool ok = false;
+    trace(TRACE_DECRYPT, index, len);
+
+#ifdef AES_CM3
+    // Fused AES-CTR + GHASH kernel (make AES_IMPL=cm3)
+    aes_cm3_gcm_context *gcm_ctx = arena_alloc(sizeof(*gcm_ctx));
+
+    if (gcm_ctx != NULL)
+    {
+        aes_cm3_gcm_init(gcm_ctx, gcm_round_keys, gcm_htab);
+        aes_cm3_gcm_reset(gcm_ctx, nonce, sizeof(nonce));
+        aes_cm3_gcm_aad_inject(gcm_ctx, aad, sizeof(aad));
+        aes_cm3_gcm_aad_inject(gcm_ctx, pkg, header_len);
+        aes_cm3_gcm_flip(gcm_ctx);
+        if (len > 0)
+        {
+            aes_cm3_gcm_run(gcm_ctx, 0, data, len);
+        }
+        ok = aes_cm3_gcm_check_tag(gcm_ctx, tag) == 1;
+    }
+#else
+    br_gcm_context *gcm_ctx = arena_alloc(sizeof(*gcm_ctx));
+
+    if (gcm_ctx != NULL)
+    {
+        // br_gcm_init() without its AES block for H. BearSSL only reads
+        // the CTR keys, so the const ones in flash serve directly.
+        gcm_ctx->vtable = &br_gcm_vtable;
+        gcm_ctx->bctx = (const br_block_ctr_class **)&gcm_aes_keys.vtable;
+        gcm_ctx->gh = br_ghash_ctmul32;
+        memcpy(gcm_ctx->h, gcm_h, sizeof(gcm_h));
+        br_gcm_reset(gcm_ctx, nonce, sizeof(nonce));
+        br_gcm_aad_inject(gcm_ctx, aad, sizeof(aad));
+        br_gcm_aad_inject(gcm_ctx, pkg, header_len);
+        br_gcm_flip(gcm_ctx);
+        if (len > 0)
+        {
+            br_gcm_run(gcm_ctx, 0, data, len);
+        }
+        ok = br_gcm_check_tag(gcm_ctx, tag) == 1;
+    }
+#endif
+
+    arena_release(mark);
+    trace(TRACE_DECRYPT_DONE, index, ok);
+    return ok;
 }
 
 // verifying if checksum for frames are correct
 bool verify_frame(unsigned char *frame_data, int frame_len, unsigned char *hashed_checksum)
 {
-    unsigned int new_checksum = 0; 
+    unsigned int new_checksum = 0;
 
     // Calculate checksum each custom algorithm
-    for (uint32_t i = 0; i < frame_len; i++)
+    for (int i = 0; i < frame_len; i++)
     {
         new_checksum += frame_data[i];
     }
-    
+
+    // The host hashes the decimal string of the byte sum
+    char checksum_str[10];
     int numlength = 0;
-    int tempnum = new_checksum;
-    while(tempnum>0){
-        tempnum = tempnum/10;
+    unsigned int tempnum = new_checksum;
+    do
+    {
         numlength++;
-    }
+        tempnum = tempnum / 10;
+    } while (tempnum > 0);
     tempnum = new_checksum;
-    char checksumarray[numlength];
-    while(tempnum>0){
-        numlength--;
-        checksumarray[numlength] = (char)tempnum%10;
-        tempnum = tempnum/10;
-    }
-    uart_write_hex(UART0, frame_data);
-    nl(UART0);
-    uart_write_hex(UART0, frame_len);
-    nl(UART0);
-    uart_write_hex(UART0, hashed_checksum);
-    nl(UART0);
-    uint8_t hash[32];
-    uint8_t data[] = "Hello, world!asdfasdf";
-    sha_hash(frame_data, frame_len, hash);
-    uart_write_hex(UART0, hash);
-    nl(UART0);
+    for (int i = numlength - 1; i >= 0; i--)
+    {
+        checksum_str[i] = '0' + (tempnum % 10);
+        tempnum = tempnum / 10;
+    }
+
+    uint8_t hash[CHECKSUM_SIZE];
+    sha_hash((unsigned char *)checksum_str, numlength, hash);
 
     // check hashes
-    // for (int i = 0; i < 64; i++)
-    // {
-    //     if (hash[i] != hashed_checksum[i])
-    //     {
-    //         return false;
-    //     }
-    //     if (sizeof(hash[i]) != sizeof(hashed_checksum[i]))
-    //     {
-    //         return false;
-    //     }
-    // }
-    // hash_sum = 0
-    // for(int i = 0; i<32; i++){
-    //      hash_sum += hash[i]<<16*i
-    //     }
-    // hash_sum = 0
-    // for(int i = 0; i<32; i++){
-    //      hash_sum += hash[i]<<16*i
-    //     }
-    // if((hash^hashed_checksum)!=0){
-    //     return false;
-    // }
-    return true;
-}
\ No newline at end of file
+    uint8_t diff = 0;
+    for (int i = 0; i < CHECKSUM_SIZE; i++)
+    {
+        diff |= hash[i] ^ hashed_checksum[i];
+    }
+    return diff == 0;
+}
+
+#ifdef CRYPTO_BENCH
+#define BENCH_LEN FLASH_PAGESIZE
+
+static uint32_t bench_bearssl(unsigned char *data, unsigned char *tag)
+{
+    // One BearSSL page decrypt, the default build's update path; returns cycles
+    unsigned char nonce[GCM_NONCE_SIZE] = {0};
+    br_aes_big_ctr_keys big_ctx;
+    br_gcm_context gcm_ctx;
+    uint32_t start = SysTickValueGet();
+    br_aes_big_ctr_init(&big_ctx, gcmkey, sizeof(gcmkey));
+    br_gcm_init(&gcm_ctx, &big_ctx.vtable, br_ghash_ctmul32);
+    br_gcm_reset(&gcm_ctx, nonce, sizeof(nonce));
+    br_gcm_aad_inject(&gcm_ctx, aad, sizeof(aad));
+    br_gcm_flip(&gcm_ctx);
+    br_gcm_run(&gcm_ctx, 0, data, BENCH_LEN);
+    br_gcm_get_tag(&gcm_ctx, tag);
+    return cycles_since(start);
+}
+
+/*
+ * Time one AES-128-GCM decrypt of a flash page with each kernel and check the
+ * outputs are bit-identical. SysTick runs from the core clock, so the counts
+ * are CPU cycles. Results go to UART2:
+ *   bearssl  - br_aes_big_ctr_vtable + br_ghash_ctmul32 (the default build)
+ *   cm3-ctr  - aes_cm3_ctr_vtable plugged into br_gcm
+ *   cm3-gcm  - fused aes_cm3_gcm kernel (make AES_IMPL=cm3)
+ * The reference expands gcmkey at run time and the fused kernel uses the
+ * build time expansion, so a match also checks bl_build.py's tables. Then
+ * come the cycles to check one FRAME_SIZE frame's trailer in each integrity
+ * mode, and last the BearSSL page decrypt at each clock profile, which shows
+ * what the update clock buys (see UPDATE_CLOCK_PROFILE).
+ */
+void crypto_bench(void)
+{
+    static unsigned char ref[BENCH_LEN];
+    static unsigned char buf[BENCH_LEN];
+    unsigned char nonce[GCM_NONCE_SIZE] = {0};
+    unsigned char ref_tag[GCM_TAG_SIZE];
+    unsigned char tag[GCM_TAG_SIZE];
+    uint32_t start;
+    uint32_t cycles;
+    bool same;
+
+    for (int i = 0; i < BENCH_LEN; i++)
+    {
+        ref[i] = (unsigned char)(i * 7);
+    }
+
+    // BearSSL reference
+    cycles = bench_bearssl(ref, ref_tag);
+    uart_write_str(UART2, "bearssl  cycles/byte: ");
+    uart_write_dec(UART2, cycles / BENCH_LEN);
+    nl(UART2);
+
+    // Our CTR under BearSSL's GCM and GHASH
+    aes_cm3_ctr_keys cm3_ctx;
+    br_gcm_context gcm_ctx;
+    for (int i = 0; i < BENCH_LEN; i++)
+    {
+        buf[i] = (unsigned char)(i * 7);
+    }
+    start = SysTickValueGet();
+    aes_cm3_ctr_init(&cm3_ctx, gcmkey, sizeof(gcmkey));
+    br_gcm_init(&gcm_ctx, &cm3_ctx.vtable, br_ghash_ctmul32);
+    br_gcm_reset(&gcm_ctx, nonce, sizeof(nonce));
+    br_gcm_aad_inject(&gcm_ctx, aad, sizeof(aad));
+    br_gcm_flip(&gcm_ctx);
+    br_gcm_run(&gcm_ctx, 0, buf, BENCH_LEN);
+    br_gcm_get_tag(&gcm_ctx, tag);
+    cycles = cycles_since(start);
+    same = memcmp(buf, ref, BENCH_LEN) == 0 && memcmp(tag, ref_tag, GCM_TAG_SIZE) == 0;
+    uart_write_str(UART2, "cm3-ctr  cycles/byte: ");
+    uart_write_dec(UART2, cycles / BENCH_LEN);
+    uart_write_str(UART2, same ? " (match)\n" : " (MISMATCH)\n");
+
+    // Fused kernel
+    static aes_cm3_gcm_context fused_ctx;
+    for (int i = 0; i < BENCH_LEN; i++)
+    {
+        buf[i] = (unsigned char)(i * 7);
+    }
+    start = SysTickValueGet();
+    aes_cm3_gcm_init(&fused_ctx, gcm_round_keys, gcm_htab);
+    aes_cm3_gcm_reset(&fused_ctx, nonce, sizeof(nonce));
+    aes_cm3_gcm_aad_inject(&fused_ctx, aad, sizeof(aad));
+    aes_cm3_gcm_flip(&fused_ctx);
+    aes_cm3_gcm_run(&fused_ctx, 0, buf, BENCH_LEN);
+    aes_cm3_gcm_get_tag(&fused_ctx, tag);
+    cycles = cycles_since(start);
+    same = memcmp(buf, ref, BENCH_LEN) == 0 && memcmp(tag, ref_tag, GCM_TAG_SIZE) == 0;
+    uart_write_str(UART2, "cm3-gcm  cycles/byte: ");
+    uart_write_dec(UART2, cycles / BENCH_LEN);
+    uart_write_str(UART2, same ? " (match)\n" : " (MISMATCH)\n");
+
+    // Frame trailers
+    start = SysTickValueGet();
+    verify_frame(ref, FRAME_SIZE, ref_tag);
+    cycles = cycles_since(start);
+    uart_write_str(UART2, "sha256 frame check cycles/frame: ");
+    uart_write_dec(UART2, cycles);
+    nl(UART2);
+
+    start = SysTickValueGet();
+    crc32_update(0, ref, FRAME_SIZE);
+    cycles = cycles_since(start);
+    uart_write_str(UART2, "crc32  frame check cycles/frame: ");
+    uart_write_dec(UART2, cycles);
+    nl(UART2);
+
+    // The same page at each clock profile: cycles stay, time shrinks
+    int boot_profile = clock_profile;
+    for (int profile = CLOCK_PROFILE_DEFAULT; profile <= CLOCK_PROFILE_PERFORMANCE; profile++)
+    {
+        clock_set_profile(profile);
+        cycles = bench_bearssl(buf, tag);
+        uart_write_str(UART2, "profile ");
+        uart_write_dec(UART2, profile);
+        uart_write_str(UART2, " page decrypt cycles: ");
+        uart_write_dec(UART2, cycles);
+        uart_write_str(UART2, ", us: ");
+        uart_write_dec(UART2, cycles / (SysCtlClockGet() / 1000000));
+        nl(UART2);
+    }
+    clock_set_profile(boot_profile);
+}
+#endif
@@ -0,0 +1,316 @@
+// Copyright 2023 The MITRE Corporation. ALL RIGHTS RESERVED
+// Approved for public release. Distribution unlimited 23-02181-13.
+
+/*
+ * Flash layout, package format and host protocol shared by the command loop
+ * (bootloader.c) and the update engine (update.c), with the state and
+ * helpers of bootloader.c that the engine uses.
+ */
+#ifndef BOOTLOADER_H
+#define BOOTLOADER_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Functions placed in SRAM (see bootloader.ld). They keep running while the
+// flash controller is busy, since no instruction fetch from flash is needed.
+// long_call because SRAM is out of BL range of code in flash.
+#define RAMFUNC __attribute__((section(".ramfunc"), long_call, noinline))
+
+// Firmware Constants
+#define METADATA_BASE 0xFC00 // base address of the component table in Flash
+#define FW_BASE 0x10000      // base address of firmware in Flash
+#define MSG_BASE 0x14000     // base address of the release message in Flash
+#define CONFIG_BASE 0x14400  // base address of the config blob in Flash
+#define MANIFEST_BASE 0x14800 // base address of the firmware page-hash manifest
+#define STATS_BASE 0x3F000    // update statistics, STATS_PAGES pages at the top of Flash
+
+// SRAM. The last 256 bytes are left out of both images' sections (see
+// bootloader.ld and firmware.ld) and keep the handoff block.
+#define HANDOFF_BASE 0x2000FF00 // handoff_t, written just before the firmware starts
+#define MAILBOX_BASE 0x2000FFC0 // mailbox_t, the last 64 bytes, past any handoff_t
+
+// FLASH Constants
+#define FLASH_PAGESIZE 1024
+#define FLASH_WRITESIZE 4
+#define FLASH_PAGES 256 // 256 KB part
+#define MAX_FW 15000
+#define MAX_MSG 1024
+#define MAX_CONFIG 1024
+
+// Components, each installed and versioned on its own
+#define COMP_FIRMWARE 0
+#define COMP_MESSAGE 1
+#define COMP_CONFIG 2
+#define COMP_COUNT 3      // component ids this device knows
+#define MAX_COMPONENTS 4  // descriptors a package header may carry
+#define DIGEST_SIZE 32
+#define TABLE_MAGIC 0x31425443 // "CTB1" read as a little-endian word
+
+// Page-hash manifest. A component's digest is the root of a Merkle tree over
+// the SHA-256 of each of its flash pages (see merkle_root), so the firmware's
+// page hashes can be kept next to it and checked one page at a time.
+#define MAX_LEAVES 16                    // pages in the largest component
+#define MANIFEST_MAGIC 0x31464E4D        // "MNF1" read as a little-endian word
+#define MANIFEST_PENDING (MANIFEST_BASE + FLASH_PAGESIZE - 4) // bit i set: page i not yet checked
+#ifndef BOOT_VERIFY_PAGES
+#define BOOT_VERIFY_PAGES 2 // unchecked pages hashed per boot, 0 for all
+#endif
+
+// Update statistics. Each save goes to the next of STATS_PAGES pages in
+// turn, so the record's own pages wear STATS_PAGES times slower than the
+// pages an update rewrites; the valid record with the highest seq is current.
+#define STATS_PAGES 4
+#define STATS_MAGIC 0x31545355 // "UST1" read as a little-endian word
+
+// Why an update was rejected, counted per cause in update_stats_t.failures
+#define STAT_FAIL_FORMAT 0    // unknown format, bad layout or component id, too large
+#define STAT_FAIL_DEVICE 1    // package built for another device
+#define STAT_FAIL_DOWNGRADE 2 // component older than the installed one
+#define STAT_FAIL_AUTH 3      // header or chunk GCM tag mismatch
+#define STAT_FAIL_FRAME 4     // bad frame marker, length or checksum
+#define STAT_FAIL_SEQUENCE 5  // component sent twice, not listed, or cut short
+#define STAT_FAIL_DIGEST 6    // page hashes do not match the descriptor's root
+#define STAT_FAIL_CAUSES 7
+
+// Package Constants (v3 container, see tools/fw_protect.py)
+#define PKG_MAGIC 0x33535742    // "BWS3" read as a little-endian word
+#define PKG_FORMAT 3
+#define GCM_TAG_SIZE 16
+#define GCM_NONCE_SIZE 12
+#define HEADER_NONCE_INDEX 0xFFFFFFFF // nonce index reserved for the header
+#define COMP_NONCE_INDEX(id, chunk) (((uint32_t)(id) << 16) | (chunk))
+#define FRAME_SIZE 256
+#define CHECKSUM_SIZE 32
+
+// Frame start markers, which also pick the frame's integrity trailer. The
+// GCM tags authenticate the data either way; the trailer only has to catch
+// transport errors, which a CRC does at a fraction of the cost.
+#define FRAME_SHA256 1 // SHA-256 of the decimal byte sum (CHECKSUM_SIZE bytes)
+#define FRAME_CRC32 2  // little-endian CRC-32 of the frame (CRC32_SIZE bytes)
+#define FRAME_STRIPED 3 // little-endian sequence number first; CRC-32 over it, the length and the data
+
+// Host receive rings, filled by uart1_rx_isr and uart2_rx_isr (power of two, > one frame)
+#define RX_RING_SIZE 512
+#define RX_LINKS 2 // UART1, and UART2 for a striped update
+
+// Protocol Constants
+#define OK ((unsigned char)0x00)
+#define ERROR ((unsigned char)0x01)
+#define UPDATE ((unsigned char)'U')
+#define STRIPED_UPDATE ((unsigned char)'W')
+#define BOOT ((unsigned char)'B')
+#define MEM_REPORT ((unsigned char)'M')
+#define COMP_QUERY ((unsigned char)'C')
+#define STATS_QUERY ((unsigned char)'S')
+#define TRACE_DUMP ((unsigned char)'T')
+#define DEVICE_QUERY ((unsigned char)'Q')
+
+// Device query reply (see device_report)
+#define DEVICE_MAGIC 0x31564544      // "DEV1" read as a little-endian word
+#define FEATURE_PARTIAL (1u << 0)    // packages may carry only some components
+#define FEATURE_STATS (1u << 1)      // 'S' update statistics
+#define FEATURE_TRACE (1u << 2)      // 'T' event trace
+#define FEATURE_CRC32 (1u << 3)      // FRAME_CRC32 frames
+#define FEATURE_STRIPE (1u << 4)     // 'W' update striped over UART1 and UART2
+
+// Clock profiles (see clock_set_profile)
+#define CLOCK_PROFILE_DEFAULT 0     // 8 MHz main crystal, PLL bypassed
+#define CLOCK_PROFILE_PERFORMANCE 1 // PLL, 50 MHz (part maximum)
+#define UART_BAUD 115200
+
+// Profile used while an update runs, and the one the firmware is started in.
+// Build with UPDATE_CLOCK=default to measure crypto time without the PLL.
+#ifndef UPDATE_CLOCK_PROFILE
+#define UPDATE_CLOCK_PROFILE CLOCK_PROFILE_PERFORMANCE
+#endif
+#ifndef BOOT_CLOCK_PROFILE
+#define BOOT_CLOCK_PROFILE CLOCK_PROFILE_DEFAULT
+#endif
+
+// Package header. It is followed by comp_count component descriptors and one
+// GCM tag over both, checked before any chunk is accepted. A chunk's nonce is
+// nonce_base followed by the big-endian COMP_NONCE_INDEX(component, chunk).
+typedef struct
+{
+    uint32_t magic;
+    uint16_t format;
+    uint16_t comp_count;
+    uint16_t chunk_size;  // plaintext bytes per chunk, one flash page
+    uint16_t reserved;
+    uint32_t device_id;   // must match the device_id built into this bootloader
+    uint8_t nonce_base[8];
+} pkg_header_t;
+
+// One component carried by a package
+typedef struct
+{
+    uint16_t id;
+    uint16_t version;
+    uint32_t size;
+    uint16_t chunk_count;
+    uint16_t reserved;
+    uint8_t digest[DIGEST_SIZE]; // Merkle root of the plaintext's page hashes
+} comp_desc_t;
+
+typedef struct
+{
+    pkg_header_t header;
+    comp_desc_t comps[MAX_COMPONENTS];
+} package_t;
+
+// One installed component, as recorded in the table at METADATA_BASE
+typedef struct
+{
+    uint16_t id;
+    uint16_t version;
+    uint32_t size;      // 0 when nothing valid is installed
+    uint32_t addr;
+    uint8_t digest[DIGEST_SIZE];
+} comp_entry_t;
+
+// Component table. The first word keeps the old firmware version/size
+// metadata layout for anything that still reads it.
+typedef struct
+{
+    uint16_t fw_version;
+    uint16_t fw_size;
+    uint32_t magic;
+    comp_entry_t comps[COMP_COUNT];
+} comp_table_t;
+
+// Page hashes of the installed firmware, at MANIFEST_BASE. The last word of
+// the page (MANIFEST_PENDING) is left erased and has a bit cleared for every
+// page boot_firmware() has checked since the image was installed.
+typedef struct
+{
+    uint32_t magic;
+    uint32_t leaf_count;
+    uint8_t leaves[MAX_LEAVES][DIGEST_SIZE];
+} manifest_t;
+
+// Update statistics record, programmed whole into one STATS_BASE page. The
+// commit word is written last and equals ~seq only when the program finished,
+// so a record cut short by a reset is ignored. Must match update_stats_t in
+// firmware/lib/update_stats.h and STATS_FMT in tools/fw_update.py.
+typedef struct
+{
+    uint32_t magic;
+    uint32_t seq;
+    uint32_t attempts;
+    uint32_t successes;
+    uint32_t failures[STAT_FAIL_CAUSES];
+    uint32_t bytes_received;   // all update traffic from the host, ever
+    uint32_t last_duration_ms; // from 'U' to the last byte of the last update
+    uint16_t erase_counts[FLASH_PAGES]; // page erases done by program_flash()
+    uint32_t commit;
+} update_stats_t;
+
+// Answer to DEVICE_QUERY. It is followed by comp_count comp_entry_t records
+// and then each component's region capacity as a u32. Must match INFO_FMT in
+// tools/fw_update.py.
+typedef struct
+{
+    uint32_t magic;
+    uint16_t format;     // package format accepted (PKG_FORMAT)
+    uint16_t max_frame;  // largest frame payload
+    uint16_t chunk_size; // plaintext bytes per chunk
+    uint16_t comp_count;
+    uint32_t features;   // FEATURE_* bits
+    uint32_t device_id;
+    uint32_t free_flash; // bytes left unused in the component regions
+} device_info_t;
+
+// What the bootloader leaves set up for the firmware, at HANDOFF_BASE. Must
+// match handoff_t in firmware/lib/handoff.h; fields are only ever appended,
+// with HANDOFF_VERSION bumped, so older firmware still finds its fields.
+#define HANDOFF_MAGIC 0x31464F48 // "HOF1" read as a little-endian word
+#define HANDOFF_VERSION 1
+#define HANDOFF_UART0 (1u << 0)  // peripherals: initialised and left enabled
+#define HANDOFF_UART1 (1u << 1)
+#define HANDOFF_UART2 (1u << 2)
+typedef struct
+{
+    uint32_t magic;
+    uint16_t version;
+    uint16_t size;          // sizeof(handoff_t)
+    uint32_t clock_hz;      // core clock at the jump
+    uint32_t clock_config;  // SysCtlClockSet() value it was set with
+    uint32_t peripherals;   // HANDOFF_* bits
+    uint32_t uart_baud;     // every initialised UART, 8N1
+    uint32_t reset_cause;   // SysCtlResetCauseGet() at bootloader start
+    uint32_t updates;       // updates installed since that reset
+    uint16_t fw_version;
+    uint16_t msg_version;
+    uint32_t fw_size;
+    uint32_t verify_cycles; // verify_boot_image()
+    uint32_t boot_cycles;   // from the boot command to the jump
+} handoff_t;
+
+// Requests from the firmware and results for it, at MAILBOX_BASE. The block
+// survives software resets; check guards against the power-on contents.
+// Must match mailbox_t in firmware/lib/mailbox.h.
+#define MAILBOX_MAGIC 0x3158424D   // "MBX1" read as a little-endian word
+#define MAILBOX_REQ_NONE 0
+#define MAILBOX_REQ_UPDATE 1       // enter update mode at once, without the banner
+#define MAILBOX_REQ_BOOT 2         // start the firmware at once (after a requested update failed)
+#define MAILBOX_STATUS_NONE 0
+#define MAILBOX_STATUS_RUNNING 1   // a requested update was started
+#define MAILBOX_STATUS_OK 2
+#define MAILBOX_STATUS_FAILED 3
+
+typedef struct
+{
+    uint32_t magic;
+    uint32_t request;   // MAILBOX_REQ_*
+    uint32_t status;    // MAILBOX_STATUS_* of the last requested update
+    uint32_t cause;     // STAT_FAIL_* if it failed
+    uint32_t installed; // bit per component id it installed
+    uint32_t check;     // ~(request ^ status ^ cause ^ installed)
+} mailbox_t;
+
+// Flash region reserved for each component id
+typedef struct
+{
+    uint32_t base;
+    uint32_t max_size;
+} comp_region_t;
+
+extern const comp_region_t comp_regions[COMP_COUNT];
+
+// Statistics (see stats_clock) and what the last update attempt left behind
+extern update_stats_t stats;
+extern uint64_t update_cycles;
+extern uint32_t update_tick;
+extern uint32_t header_fail;
+extern uint32_t updates_installed;
+
+// Host receive rings, filled by uart1_rx_isr and uart2_rx_isr
+extern volatile uint8_t rx_ring[RX_RING_SIZE];
+extern volatile uint32_t rx_head;
+extern volatile uint32_t rx_tail;
+extern volatile uint8_t rx2_ring[RX_RING_SIZE];
+extern volatile uint32_t rx2_head;
+extern volatile uint32_t rx2_tail;
+
+void boot_firmware(void);
+RAMFUNC long program_flash(uint32_t, unsigned char *, unsigned int);
+RAMFUNC void erase_page(uint32_t page_addr, uint32_t ahead);
+RAMFUNC long write_page(uint32_t page_addr, unsigned char *data, unsigned int data_len);
+bool verify_frame(unsigned char *frame_data, int frame_len, unsigned char *hashed_checksum);
+void stripe_enable(bool on);
+void mailbox_post(uint32_t request, uint32_t status, uint32_t cause, uint32_t installed);
+void uart_write_dec(uint8_t uart, uint32_t num);
+void clock_set_profile(int profile);
+uint32_t cycles_since(uint32_t start);
+bool decrypt_aes(const package_t *pkg, uint32_t index, unsigned char *data, uint32_t len, const unsigned char *tag);
+bool check_header_prefix(const pkg_header_t *header);
+bool check_header(const package_t *pkg, const comp_table_t *table, const unsigned char *tag);
+const comp_desc_t *find_desc(const package_t *pkg, uint32_t id);
+void table_load(comp_table_t *table);
+void table_set(comp_table_t *table, uint16_t id, uint16_t version, uint32_t size, const uint8_t *digest);
+bool merkle_root(const uint8_t *leaves, uint32_t count, uint8_t *root);
+void stats_save(void);
+void stats_clock(void);
+
+#endif
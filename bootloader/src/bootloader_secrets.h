@@ -1,6 +1,12 @@
 #ifndef main.h
 #define bootloader_secrets.h
 const char cbckey[16] = {'Z','F','x','P','w','%','I','A','M','n','$','G','(','p','k','l',};
+#ifdef CRYPTO_BENCH
 const char gcmkey[16] = {'+','y','A','C','5','8','y','e','^','D','_','n','*','S','|','z',};
+#endif
 const char aad[177] = {'A','c','c','o','r','d','i','n','g','t','o','a','l','l','k','n','o','w','n','l','a','w','s','o','f','a','v','i','a','t','i','o','n','t','h','e','r','e','i','s','n','o','w','a','y','a','b','e','e','s','h','o','u','l','d','b','e','a','b','l','e','t','o','f','l','y','I','t','s','w','i','n','g','s','a','r','e','t','o','o','s','m','a','l','l','t','o','g','e','t','i','t','s','f','a','t','l','i','t','t','l','e','b','o','d','y','o','f','f','t','h','e','g','r','o','u','n','d','T','h','e','b','e','e','o','f','c','o','u','r','s','e','f','l','i','e','s','a','n','y','w','a','y','b','e','c','a','u','s','e','b','e','e','s','d','o','n','t','c','a','r','e','w','h','a','t','h','u','m','a','n','s','t','h','i','n','k',};
+const unsigned long device_id = 0x5A17C3E9;
+#define GCM_ROUND_KEYS {0x2B794143, 0x35387965, 0x5E445F6E, 0x2A537C7A, 0xC7699BA6, 0xF251E2C3, 0xAC15BDAD, 0x8646C1D7, 0x9F1195E2, 0x6D407721, 0xC155CA8C, 0x47130B5B, 0xE63AAC42, 0x8B7ADB63, 0x4A2F11EF, 0x0D3C1AB4, 0x05982195, 0x8EE2FAF6, 0xC4CDEB19, 0xC9F1F1AD, 0xB439B448, 0x3ADB4EBE, 0xFE16A5A7, 0x37E7540A, 0x0019D3D2, 0x3AC29D6C, 0xC4D438CB, 0xF3336CC1, 0x8349ABDF, 0xB98B36B3, 0x7D5F0E78, 0x8E6C62B9, 0x53E3FDC6, 0xEA68CB75, 0x9737C50D, 0x195BA7B4, 0x71BF7012, 0x9BD7BB67, 0x0CE07E6A, 0x15BBD9DE, 0xAD8A6D4B, 0x365DD62C, 0x3ABDA846, 0x2F067198}
+#define GCM_H {0xF3, 0x9D, 0xB1, 0xBB, 0xD3, 0xC6, 0x13, 0x44, 0xBE, 0x33, 0xFF, 0xF4, 0x40, 0x11, 0x5F, 0x70}
+#define GCM_HTAB {{0x00000000, 0x00000000, 0x00000000, 0x00000000}, {0x1E73B637, 0x7A78C268, 0x97C67FFE, 0x88022BEE}, {0x3CE76C6E, 0xF4F184D1, 0x2F8CFFFD, 0x100457DC}, {0x2294DA59, 0x8E8946B9, 0xB84A8003, 0x98067C32}, {0x79CED8DD, 0xE9E309A2, 0x5F19FFFA, 0x2008AFB8}, {0x67BD6EEA, 0x939BCBCA, 0xC8DF8004, 0xA80A8456}, {0x4529B4B3, 0x1D128D73, 0x70950007, 0x300CF864}, {0x5B5A0284, 0x676A4F1B, 0xE7537FF9, 0xB80ED38A}, {0xF39DB1BB, 0xD3C61344, 0xBE33FFF4, 0x40115F70}, {0xEDEE078C, 0xA9BED12C, 0x29F5800A, 0xC813749E}, {0xCF7ADDD5, 0x27379795, 0x91BF0009, 0x501508AC}, {0xD1096BE2, 0x5D4F55FD, 0x06797FF7, 0xD8172342}, {0x8A536966, 0x3A251AE6, 0xE12A000E, 0x6019F0C8}, {0x9420DF51, 0x405DD88E, 0x76EC7FF0, 0xE81BDB26}, {0xB6B40508, 0xCED49E37, 0xCEA6FFF3, 0x701DA714}, {0xA8C7B33F, 0xB4AC5C5F, 0x5960800D, 0xF81F8CFA}}
 #endif
\ No newline at end of file
@@ -0,0 +1,64 @@
+// Copyright 2023 The MITRE Corporation. ALL RIGHTS RESERVED
+// Approved for public release. Distribution unlimited 23-02181-13.
+
+#include <string.h>
+#include "crc32.h"
+
+#define CRC32_POLY 0xEDB88320 // reflected 0x04C11DB7
+
+static uint32_t crc_table[4][256];
+
+/*
+ * Table 0 is the usual byte-at-a-time table; table k advances a byte through
+ * k further zero bytes, so four lookups cover one word.
+ */
+void crc32_init(void)
+{
+    for (uint32_t i = 0; i < 256; i++)
+    {
+        uint32_t c = i;
+        for (int bit = 0; bit < 8; bit++)
+        {
+            c = (c & 1) ? (c >> 1) ^ CRC32_POLY : c >> 1;
+        }
+        crc_table[0][i] = c;
+    }
+    for (uint32_t i = 0; i < 256; i++)
+    {
+        uint32_t c = crc_table[0][i];
+        for (int k = 1; k < 4; k++)
+        {
+            c = crc_table[0][c & 0xFF] ^ (c >> 8);
+            crc_table[k][i] = c;
+        }
+    }
+}
+
+uint32_t crc32_update(uint32_t crc, const uint8_t *data, uint32_t len)
+{
+    crc = ~crc;
+
+    // Bytes up to a word boundary, then a word per step
+    while (len > 0 && ((uintptr_t)data & 3))
+    {
+        crc = crc_table[0][(crc ^ *data++) & 0xFF] ^ (crc >> 8);
+        len--;
+    }
+    while (len >= 4)
+    {
+        uint32_t word;
+        memcpy(&word, data, sizeof(word)); // aligned, a single load
+        crc ^= word;
+        crc = crc_table[3][crc & 0xFF] ^ crc_table[2][(crc >> 8) & 0xFF] ^
+              crc_table[1][(crc >> 16) & 0xFF] ^ crc_table[0][crc >> 24];
+        data += 4;
+        len -= 4;
+    }
+    while (len > 0)
+    {
+        crc = crc_table[0][(crc ^ *data++) & 0xFF] ^ (crc >> 8);
+        len--;
+    }
+
+    return ~crc;
+}
@@ -0,0 +1,21 @@
+// Copyright 2023 The MITRE Corporation. ALL RIGHTS RESERVED
+// Approved for public release. Distribution unlimited 23-02181-13.
+
+/*
+ * CRC-32 (IEEE 802.3, reflected, as zlib.crc32) for frame integrity.
+ *
+ * Slice-by-4: four 256-entry tables let the loop fold in a whole word per
+ * step instead of a byte. The tables are built once by crc32_init().
+ */
+#ifndef CRC32_H
+#define CRC32_H
+
+#include <stdint.h>
+
+#define CRC32_SIZE 4 // trailer bytes
+
+void crc32_init(void);
+// Chainable like zlib: crc32_update(crc32_update(0, a), b) is the CRC of a||b
+uint32_t crc32_update(uint32_t crc, const uint8_t *data, uint32_t len);
+
+#endif
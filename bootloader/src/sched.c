@@ -0,0 +1,51 @@
+// Copyright 2023 The MITRE Corporation. ALL RIGHTS RESERVED
+// Approved for public release. Distribution unlimited 23-02181-13.
+
+#include <stddef.h>
+#include "driverlib/systick.h"
+#include "sched.h"
+
+static task_t *tasks[SCHED_MAX_TASKS];
+static uint32_t task_count = 0;
+
+/*
+ * Add a task; tasks added earlier run first in each pass.
+ */
+void sched_add(task_t *task)
+{
+    if (task_count < SCHED_MAX_TASKS)
+    {
+        tasks[task_count++] = task;
+    }
+}
+
+/*
+ * One pass over the tasks. The ready flag is cleared before a task runs, so
+ * a task that still has work left signals itself again.
+ */
+bool sched_run(void)
+{
+    bool ran = false;
+
+    for (uint32_t i = 0; i < task_count; i++)
+    {
+        task_t *task = tasks[i];
+        if (!task->ready)
+        {
+            continue;
+        }
+        task->ready = false;
+
+        uint32_t start = SysTickValueGet();
+        task->run();
+        task->cycles += (start - SysTickValueGet()) & 0xFFFFFF;
+        task->runs++;
+        ran = true;
+    }
+    return ran;
+}
+
+task_t *sched_task(uint32_t i)
+{
+    return i < task_count ? tasks[i] : NULL;
+}
@@ -0,0 +1,38 @@
+// Copyright 2023 The MITRE Corporation. ALL RIGHTS RESERVED
+// Approved for public release. Distribution unlimited 23-02181-13.
+
+/*
+ * Cooperative task scheduler for the bootloader's main loop.
+ *
+ * A task runs only after it has been signalled, does a bounded piece of work
+ * and returns. Tasks signal each other as they hand work on, and the main
+ * loop signals them on UART and timer events. Nothing but the UART1 receive
+ * interrupt preempts a task, so tasks share state without locking.
+ */
+#ifndef SCHED_H
+#define SCHED_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define SCHED_MAX_TASKS 8
+
+typedef struct
+{
+    const char *name;
+    void (*run)(void);
+    bool ready;      // signalled since it last ran
+    uint32_t runs;
+    uint32_t cycles; // core clocks spent running
+} task_t;
+
+void sched_add(task_t *task);
+bool sched_run(void); // run each ready task once, in the order added; false if none was
+task_t *sched_task(uint32_t i); // NULL past the last task
+
+static inline void sched_signal(task_t *task)
+{
+    task->ready = true;
+}
+
+#endif
@@ -71,10 +71,14 @@ extern int main(void);
 
 //*****************************************************************************
 //
-// Reserve space for the system stack.
+// Reserve space for the system stack.  The stack is painted with STACK_PAINT
+// at reset so StackHighWater() can report the deepest use since then.  The
+// large update buffers live in the static arena (arena.c), not on the stack.
 //
 //*****************************************************************************
-static unsigned long pulStack[64];
+#define STACK_WORDS 512
+#define STACK_PAINT 0xDEADBEEF
+static unsigned long pulStack[STACK_WORDS];
 
 //*****************************************************************************
 //
@@ -171,6 +175,9 @@ extern unsigned long _data;
 extern unsigned long _edata;
 extern unsigned long _bss;
 extern unsigned long _ebss;
+extern unsigned long _ramfunc_load;
+extern unsigned long _ramfunc;
+extern unsigned long _eramfunc;
 
 //*****************************************************************************
 //
@@ -185,7 +192,7 @@ extern unsigned long _ebss;
 void
 ResetISR(void)
 {
-    unsigned long *pulSrc, *pulDest;
+    unsigned long *pulSrc, *pulDest, *pulSp;
 
     //
     // Copy the data segment initializers from flash to SRAM.
@@ -196,6 +203,15 @@ ResetISR(void)
         *pulDest++ = *pulSrc++;
     }
 
+    //
+    // Copy the RAM-resident functions (.ramfunc) from flash to SRAM.
+    //
+    pulSrc = &_ramfunc_load;
+    for(pulDest = &_ramfunc; pulDest < &_eramfunc; )
+    {
+        *pulDest++ = *pulSrc++;
+    }
+
     //
     // Zero fill the bss segment.
     //
@@ -209,12 +225,54 @@ ResetISR(void)
           "        strlt   r2, [r0], #4\n"
           "        blt     zero_loop");
 
+    //
+    // Paint the stack below the current stack pointer.  The stack array is
+    // in the bss segment, so this must follow the zero fill.
+    //
+    __asm volatile("    mov     %0, sp\n" : "=r" (pulSp));
+    for(pulDest = pulStack; pulDest < pulSp; )
+    {
+        *pulDest++ = STACK_PAINT;
+    }
+
     //
     // Call the application's entry point.
     //
     main();
 }
 
+//*****************************************************************************
+//
+// Returns the most stack, in bytes, used since reset: everything above the
+// lowest word that no longer holds the paint pattern.
+//
+//*****************************************************************************
+unsigned long
+StackHighWater(void)
+{
+    unsigned long ulIdx;
+
+    for(ulIdx = 0; ulIdx < STACK_WORDS; ulIdx++)
+    {
+        if(pulStack[ulIdx] != STACK_PAINT)
+        {
+            break;
+        }
+    }
+    return (STACK_WORDS - ulIdx) * sizeof(unsigned long);
+}
+
+//*****************************************************************************
+//
+// Returns the size of the system stack in bytes.
+//
+//*****************************************************************************
+unsigned long
+StackSize(void)
+{
+    return sizeof(pulStack);
+}
+
 //*****************************************************************************
 //
 // This is the code that gets called when the processor receives a NMI.  This
@@ -0,0 +1,63 @@
+// Copyright 2023 The MITRE Corporation. ALL RIGHTS RESERVED
+// Approved for public release. Distribution unlimited 23-02181-13.
+
+#include "trace.h"
+#include "uart.h"
+#include "driverlib/sysctl.h"
+
+// Kept across software resets (see .noinit in bootloader.ld), so the events
+// before a rejected update's reset can still be dumped
+#define NOINIT __attribute__((section(".noinit")))
+
+#if TRACE_ENTRIES > 0
+trace_entry_t trace_ring[TRACE_ENTRIES] NOINIT;
+#endif
+uint32_t trace_count NOINIT;
+uint32_t trace_time NOINIT;
+static uint32_t trace_magic NOINIT;
+uint32_t trace_last = 0;
+
+void uart_write_u32(uint8_t uart, uint32_t value); // bootloader.c
+
+/*
+ * Start the clock and record the core frequency, which the decoder needs to
+ * turn clocks into time until the first TRACE_CLOCK event. The ring is only
+ * cleared at power-on; after a software reset it carries on.
+ */
+void trace_init(void)
+{
+    if (trace_magic != TRACE_MAGIC)
+    {
+        trace_magic = TRACE_MAGIC;
+        trace_count = 0;
+        trace_time = 0;
+    }
+    trace_last = HWREG(NVIC_ST_CURRENT);
+    trace(TRACE_BOOT, SysCtlClockGet(), 0);
+}
+
+/*
+ * Send the ring on UART2, oldest event first: TRACE_MAGIC, the number of
+ * entries that follow, the number of events recorded since power-on (more
+ * means the oldest were overwritten), then each trace_entry_t. All words
+ * are little-endian.
+ */
+void trace_dump(void)
+{
+    uint32_t count = trace_count;
+    uint32_t kept = count < TRACE_ENTRIES ? count : TRACE_ENTRIES;
+
+    uart_write_u32(UART2, TRACE_MAGIC);
+    uart_write_u32(UART2, kept);
+    uart_write_u32(UART2, count);
+#if TRACE_ENTRIES > 0
+    for (uint32_t i = count - kept; i != count; i++)
+    {
+        const trace_entry_t *entry = &trace_ring[i & (TRACE_ENTRIES - 1)];
+        uart_write_u32(UART2, entry->time);
+        uart_write_u32(UART2, entry->event);
+        uart_write_u32(UART2, entry->arg0);
+        uart_write_u32(UART2, entry->arg1);
+    }
+#endif
+}
@@ -0,0 +1,84 @@
+// Copyright 2023 The MITRE Corporation. ALL RIGHTS RESERVED
+// Approved for public release. Distribution unlimited 23-02181-13.
+
+/*
+ * Binary event trace.
+ *
+ * Each trace point stores a timestamp, an event id and two argument words in
+ * a RAM ring, which costs a handful of instructions and no UART traffic, so
+ * it can sit in the update loop without changing its timing. The ring is
+ * dumped on UART2 with the 'T' command and rendered by tools/bl_trace.py.
+ */
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdint.h>
+#include "inc/hw_types.h"
+#include "inc/hw_nvic.h"
+
+// Events kept (power of two; the oldest are overwritten). Build with
+// TRACE=0 to compile every trace point out.
+#ifndef TRACE_ENTRIES
+#define TRACE_ENTRIES 256
+#endif
+#define TRACE_MAGIC 0x31435254 // "TRC1" read as a little-endian word
+
+// Event ids, with their arguments. Must match EVENTS in tools/bl_trace.py.
+#define TRACE_BOOT 1          // core clock Hz
+#define TRACE_CLOCK 2         // clock profile, core clock Hz
+#define TRACE_UPDATE_START 3
+#define TRACE_HEADER 4        // component count, 1 if accepted
+#define TRACE_REJECT 5        // STAT_FAIL_* cause
+#define TRACE_UPDATE_DONE 6   // bitmap of installed component ids
+#define TRACE_RX 7            // bytes wanted, bytes already in the ring
+#define TRACE_FRAME 8         // frame length
+#define TRACE_ACK 9           // response byte sent to the host
+#define TRACE_SECTION 10      // component id, chunk count
+#define TRACE_DECRYPT 11      // nonce index, length
+#define TRACE_DECRYPT_DONE 12 // nonce index, 1 if the tag matched
+#define TRACE_ERASE 13        // page address, 1 if erased ahead of its data
+#define TRACE_PROGRAM_DONE 14 // page address, 0 or -1 on access error
+#define TRACE_BOOT_FW 15      // firmware version
+
+typedef struct
+{
+    uint32_t time; // core clocks since trace_init()
+    uint32_t event;
+    uint32_t arg0;
+    uint32_t arg1;
+} trace_entry_t;
+
+extern trace_entry_t trace_ring[];
+extern uint32_t trace_count; // events recorded since power-on
+extern uint32_t trace_time;
+extern uint32_t trace_last;
+
+/*
+ * Record one event. Time is kept from SysTick deltas, so a gap between two
+ * events is only right if it is shorter than one SysTick wrap (2^24 clocks).
+ * Main context only, not from ISRs. Always inlined, even at -Os, so RAMFUNC
+ * code can trace without a call into flash.
+ */
+__attribute__((always_inline)) static inline void trace(uint32_t event, uint32_t arg0, uint32_t arg1)
+{
+#if TRACE_ENTRIES > 0
+    uint32_t now = HWREG(NVIC_ST_CURRENT);
+    trace_time += (trace_last - now) & 0xFFFFFF;
+    trace_last = now;
+
+    trace_entry_t *entry = &trace_ring[trace_count++ & (TRACE_ENTRIES - 1)];
+    entry->time = trace_time;
+    entry->event = event;
+    entry->arg0 = arg0;
+    entry->arg1 = arg1;
+#else
+    (void)event;
+    (void)arg0;
+    (void)arg1;
+#endif
+}
+
+void trace_init(void); // after SysTick is running
+void trace_dump(void);
+
+#endif
@@ -0,0 +1,810 @@
+// Copyright 2023 The MITRE Corporation. ALL RIGHTS RESERVED
+// Approved for public release. Distribution unlimited 23-02181-13.
+
+#include <stdbool.h>
+#include <string.h>
+
+#include "inc/hw_memmap.h"
+#include "inc/hw_types.h"
+#include "inc/hw_uart.h"
+#include "driverlib/sysctl.h"
+#include "driverlib/systick.h"
+
+#include <bearssl.h>
+
+#include "uart.h"
+#include "arena.h"
+#include "trace.h"
+#include "crc32.h"
+#include "sched.h"
+#include "bootloader.h"
+#include "update.h"
+
+void rx_task_run(void);
+void link_receive(rx_link_t *link);
+bool rx_parse(void);
+bool rx_take(rx_link_t *link, uint8_t *dst, uint32_t need);
+void crypto_task_run(void);
+void flash_task_run(void);
+void update_finish(void);
+void tick_task_run(void);
+void diag_task_run(void);
+void log_task_run(void);
+
+task_t rx_task = {"receive", rx_task_run};
+task_t crypto_task = {"crypto", crypto_task_run};
+task_t flash_task = {"flash", flash_task_run};
+task_t tick_task = {"tick", tick_task_run};
+task_t diag_task = {"diag", diag_task_run};
+task_t log_task = {"log", log_task_run};
+
+update_engine_t engine;
+
+// UART2 text waiting for the log task
+static char log_ring[LOG_RING_SIZE];
+static uint32_t log_head = 0;
+static uint32_t log_tail = 0;
+
+/*
+ * Start an update.
+ *
+ * The host sends a v3 package header listing every component of the package
+ * (id, version, size, digest) under one GCM tag. Then, in frames, one section
+ * per component it chose to send: the little-endian component id followed by
+ * that component's chunks (ciphertext + GCM tag, one flash page each).
+ * Components that are not sent stay as installed, so a new release message
+ * does not re-flash the firmware. A component is entered in the table only
+ * after its last chunk and its digest check out.
+ *
+ * Nothing in the update waits. The receive task takes whatever the ring
+ * holds and moves the protocol along; each complete chunk goes through one
+ * of CHUNK_SLOTS buffers to the crypto task (decrypt, page hash) and then to
+ * the flash task (program, table). A frame is acknowledged once its bytes
+ * are in a slot, so the host sends the next frame while earlier chunks are
+ * still being decrypted and programmed, and the flash task erases a chunk's
+ * page while the chunk is still arriving (but not before the component's
+ * first chunk has been authenticated). A chunk that fails later is
+ * answered on whichever frame the host is then waiting for.
+ *
+ * A striped update ('W') has links == RX_LINKS: the host sends frame i on
+ * UART1 or UART2 in turn, each with its sequence number, and keeps one
+ * frame in flight per link. Both links receive at once; frames are parsed
+ * in sequence order and all acknowledgements go out on UART1.
+ */
+void update_start(uint32_t links)
+{
+    update_engine_t *e = &engine;
+
+    memset(e, 0, sizeof(*e));
+    e->arena_mark = arena_mark();
+    e->pkg = arena_alloc(sizeof(*e->pkg));
+    e->table = arena_alloc(sizeof(*e->table));
+    e->sha_ctx = arena_alloc(sizeof(*e->sha_ctx));
+    e->manifest = arena_alloc(sizeof(*e->manifest));
+    e->link_count = links;
+    for (uint32_t i = 0; i < links; i++)
+    {
+        e->links[i].frame = arena_alloc(FRAME_SIZE);
+    }
+    e->links[0].ring = rx_ring;
+    e->links[0].head = &rx_head;
+    e->links[0].tail = &rx_tail;
+    e->links[1].ring = rx2_ring;
+    e->links[1].head = &rx2_head;
+    e->links[1].tail = &rx2_tail;
+    for (int i = 0; i < CHUNK_SLOTS; i++)
+    {
+        e->slots[i].data = arena_alloc(FLASH_PAGESIZE + GCM_TAG_SIZE);
+    }
+
+    // No room for the update's buffers: refuse it like an oversized package
+    bool ok = e->pkg != NULL && e->table != NULL && e->sha_ctx != NULL && e->manifest != NULL;
+    for (uint32_t i = 0; i < links; i++)
+    {
+        ok = ok && e->links[i].frame != NULL;
+    }
+    for (int i = 0; i < CHUNK_SLOTS; i++)
+    {
+        ok = ok && e->slots[i].data != NULL;
+    }
+    if (!ok)
+    {
+        arena_release(e->arena_mark);
+        reject_update(STAT_FAIL_FORMAT);
+    }
+
+    // Count the attempt before anything can fail
+    update_cycles = 0;
+    update_tick = SysTickValueGet();
+    stats.attempts++;
+    stats_save();
+    trace(TRACE_UPDATE_START, 0, 0);
+
+    e->state = RX_HEADER;
+    e->active = true;
+    sched_signal(&rx_task);
+}
+
+/*
+ * Receive task: advance the protocol as far as the bytes in the ring allow.
+ */
+void rx_task_run(void)
+{
+    update_engine_t *e = &engine;
+    uint32_t start;
+    bool ok;
+
+    while (e->active)
+    {
+        switch (e->state)
+        {
+        case RX_HEADER:
+            if (!rx_take(&e->links[0], (uint8_t *)&e->pkg->header, sizeof(e->pkg->header)))
+            {
+                return;
+            }
+            stats.bytes_received += sizeof(e->pkg->header);
+
+            // Fail fast: a package for another device or format is turned
+            // away on its first bytes
+            if (!check_header_prefix(&e->pkg->header))
+            {
+                reject_update(header_fail);
+                return;
+            }
+            e->state = RX_DESCS;
+            break;
+
+        case RX_DESCS:
+            if (!rx_take(&e->links[0], (uint8_t *)e->pkg->comps, e->pkg->header.comp_count * sizeof(comp_desc_t)))
+            {
+                return;
+            }
+            e->state = RX_HEADER_TAG;
+            break;
+
+        case RX_HEADER_TAG:
+            if (!rx_take(&e->links[0], e->links[0].field, GCM_TAG_SIZE))
+            {
+                return;
+            }
+            stats.bytes_received += e->pkg->header.comp_count * sizeof(comp_desc_t) + GCM_TAG_SIZE;
+
+            // Downgrades and oversize components are turned away before any
+            // payload frame is accepted
+            table_load(e->table);
+            start = SysTickValueGet();
+            ok = check_header(e->pkg, e->table, e->links[0].field);
+            e->crypto_cycles += cycles_since(start);
+            trace(TRACE_HEADER, e->pkg->header.comp_count, ok);
+            if (!ok)
+            {
+                reject_update(header_fail);
+                return;
+            }
+
+            trace(TRACE_ACK, OK, 0);
+            uart_write(UART1, OK); // Acknowledge the header.
+            e->state = RX_FRAMES;
+            break;
+
+        case RX_FRAMES:
+        {
+            // Let every link receive, then take the frame whose turn it is
+            rx_link_t *next = NULL;
+            for (uint32_t i = 0; i < e->link_count && e->active; i++)
+            {
+                rx_link_t *link = &e->links[i];
+                link_receive(link);
+                if (link->state == LINK_READY && link->seq == (e->next_seq & 0xFFFF))
+                {
+                    next = link;
+                }
+            }
+            if (next == NULL || !e->active)
+            {
+                return;
+            }
+            e->current = next;
+            e->frame_type = next->frame_type;
+            if (next->frame_len == 0)
+            {
+                // The transfer may only end between sections. A striped
+                // end frame was counted with its trailer.
+                if (next->frame_type != FRAME_STRIPED)
+                {
+                    stats.bytes_received += 4;
+                }
+                if (e->desc != NULL || e->id_fill != 0)
+                {
+                    reject_update(STAT_FAIL_SEQUENCE);
+                    return;
+                }
+                e->state = RX_DRAIN;
+                break;
+            }
+            e->parsed = 0;
+            e->state = RX_PARSE;
+            break;
+        }
+
+        case RX_PARSE:
+            if (!rx_parse())
+            {
+                return; // Waiting for a free slot
+            }
+            trace(TRACE_ACK, OK, 0);
+            uart_write(UART1, OK); // Acknowledge the frame.
+            e->current->state = LINK_MARKER;
+            e->next_seq++;
+            e->state = RX_FRAMES;
+            break;
+
+        case RX_DRAIN:
+            // Every chunk must be in flash before the final acknowledgement
+            if (e->programmed == e->filled)
+            {
+                update_finish();
+            }
+            return;
+        }
+    }
+}
+
+/*
+ * Receive as much of a link's frame as its ring holds: marker, sequence
+ * number (striped frames), length, payload and trailer. Stops when the
+ * ring runs dry or the frame is checked and ready to be parsed.
+ */
+void link_receive(rx_link_t *link)
+{
+    update_engine_t *e = &engine;
+    uint32_t start;
+    bool ok;
+
+    while (link->state != LINK_READY)
+    {
+        switch (link->state)
+        {
+        case LINK_MARKER:
+            // Frame start marker, little-endian. A striped update takes
+            // striped frames only, any other update none.
+            if (!rx_take(link, link->field, 2))
+            {
+                return;
+            }
+            link->frame_type = link->field[0] | (link->field[1] << 8);
+            if (e->link_count > 1 ? link->frame_type != FRAME_STRIPED
+                                  : link->frame_type != FRAME_SHA256 && link->frame_type != FRAME_CRC32)
+            {
+                reject_update(STAT_FAIL_FRAME);
+                return;
+            }
+            link->crc = 0;
+            link->seq = e->next_seq & 0xFFFF; // one link: frames are in order
+            link->state = link->frame_type == FRAME_STRIPED ? LINK_SEQ : LINK_LENGTH;
+            break;
+
+        case LINK_SEQ:
+            // Sequence number, little-endian, covered by the CRC
+            if (!rx_take(link, link->field, 2))
+            {
+                return;
+            }
+            link->seq = link->field[0] | (link->field[1] << 8);
+            start = SysTickValueGet();
+            link->crc = crc32_update(link->crc, link->field, 2);
+            e->check_cycles += cycles_since(start);
+            link->state = LINK_LENGTH;
+            break;
+
+        case LINK_LENGTH:
+            // Frame length, big-endian. A striped frame's CRC covers it, and
+            // its zero length end frame still has a trailer; other zero
+            // length frames have none.
+            if (!rx_take(link, link->field, 2))
+            {
+                return;
+            }
+            link->frame_len = (link->field[0] << 8) | link->field[1];
+            if (link->frame_len > FRAME_SIZE)
+            {
+                reject_update(STAT_FAIL_FRAME);
+                return;
+            }
+            if (link->frame_type == FRAME_STRIPED)
+            {
+                start = SysTickValueGet();
+                link->crc = crc32_update(link->crc, link->field, 2);
+                e->check_cycles += cycles_since(start);
+            }
+            if (link->frame_len != 0)
+            {
+                link->state = LINK_DATA;
+            }
+            else
+            {
+                link->state = link->frame_type == FRAME_STRIPED ? LINK_TRAILER : LINK_READY;
+            }
+            break;
+
+        case LINK_DATA:
+        {
+            // The CRC runs over each piece of the frame as it arrives
+            uint32_t before = link->got;
+            bool done = rx_take(link, link->frame, link->frame_len);
+            uint32_t after = done ? link->frame_len : link->got;
+            if (link->frame_type != FRAME_SHA256 && after > before)
+            {
+                start = SysTickValueGet();
+                link->crc = crc32_update(link->crc, link->frame + before, after - before);
+                e->check_cycles += cycles_since(start);
+            }
+            if (!done)
+            {
+                return;
+            }
+            link->state = LINK_TRAILER;
+            break;
+        }
+
+        case LINK_TRAILER:
+            if (link->frame_type != FRAME_SHA256)
+            {
+                if (!rx_take(link, link->field, CRC32_SIZE))
+                {
+                    return;
+                }
+                ok = link->crc == (link->field[0] | (link->field[1] << 8) | (link->field[2] << 16) | ((uint32_t)link->field[3] << 24));
+                stats.bytes_received += (link->frame_type == FRAME_STRIPED ? 6 : 4) + link->frame_len + CRC32_SIZE;
+            }
+            else
+            {
+                if (!rx_take(link, link->field, CHECKSUM_SIZE))
+                {
+                    return;
+                }
+                start = SysTickValueGet();
+                ok = verify_frame(link->frame, link->frame_len, link->field);
+                e->check_cycles += cycles_since(start);
+                stats.bytes_received += 4 + link->frame_len + CHECKSUM_SIZE;
+            }
+            trace(TRACE_FRAME, link->frame_len, link->frame_type);
+            e->frames++;
+            if (!ok)
+            {
+                reject_update(STAT_FAIL_FRAME);
+                return;
+            }
+            link->state = LINK_READY;
+            break;
+
+        case LINK_READY:
+            break;
+        }
+    }
+}
+
+/*
+ * Hand the bytes of a checked frame on: section ids to the engine, chunk
+ * bytes to the slot being filled. False while the next chunk has no free
+ * slot; the flash task signals the receive task when it frees one.
+ */
+bool rx_parse(void)
+{
+    update_engine_t *e = &engine;
+    rx_link_t *link = e->current;
+
+    while (e->parsed < link->frame_len)
+    {
+        if (e->desc == NULL)
+        {
+            // Section start: the id of the next component
+            e->id_bytes[e->id_fill++] = link->frame[e->parsed++];
+            if (e->id_fill < sizeof(e->id_bytes))
+            {
+                continue;
+            }
+            e->id_fill = 0;
+
+            e->desc = find_desc(e->pkg, e->id_bytes[0] | (e->id_bytes[1] << 8));
+            if (e->desc == NULL || (e->seen & (1u << e->desc->id)))
+            {
+                reject_update(STAT_FAIL_SEQUENCE); // Not in this package, or sent twice
+                return false;
+            }
+            e->seen |= 1u << e->desc->id;
+            e->next_index = 0;
+            trace(TRACE_SECTION, e->desc->id, e->desc->chunk_count);
+            continue;
+        }
+
+        chunk_slot_t *slot = &e->slots[e->filled % CHUNK_SLOTS];
+        if (slot->state == SLOT_FREE)
+        {
+            slot->desc = e->desc;
+            slot->index = e->next_index;
+            slot->len = e->desc->size - (e->next_index * FLASH_PAGESIZE);
+            if (slot->len > FLASH_PAGESIZE)
+            {
+                slot->len = FLASH_PAGESIZE;
+            }
+            slot->fill = 0;
+            slot->state = SLOT_FILLING;
+            sched_signal(&flash_task); // It can erase the page meanwhile
+        }
+        else if (slot->state != SLOT_FILLING)
+        {
+            return false;
+        }
+
+        uint32_t n = slot->len + GCM_TAG_SIZE - slot->fill;
+        if (n > link->frame_len - e->parsed)
+        {
+            n = link->frame_len - e->parsed;
+        }
+        memcpy(slot->data + slot->fill, link->frame + e->parsed, n);
+        slot->fill += n;
+        e->parsed += n;
+        if (slot->fill < slot->len + GCM_TAG_SIZE)
+        {
+            continue;
+        }
+
+        slot->state = SLOT_SEALED;
+        e->filled++;
+        sched_signal(&crypto_task);
+        if (++e->next_index == e->desc->chunk_count)
+        {
+            e->desc = NULL;
+        }
+    }
+    return true;
+}
+
+/*
+ * Crypto task: decrypt and authenticate the oldest sealed chunk and keep
+ * its page hash.
+ */
+void crypto_task_run(void)
+{
+    update_engine_t *e = &engine;
+    chunk_slot_t *slot = &e->slots[e->decrypted % CHUNK_SLOTS];
+
+    // A component's page hashes overwrite the previous one's in the manifest,
+    // so its first chunk waits until that component has been checked
+    if (!e->active || slot->state != SLOT_SEALED || (slot->index == 0 && e->programmed != e->decrypted))
+    {
+        return;
+    }
+
+    uint32_t start = SysTickValueGet();
+    bool ok = decrypt_aes(e->pkg, COMP_NONCE_INDEX(slot->desc->id, slot->index), slot->data, slot->len, slot->data + slot->len);
+    e->crypto_cycles += cycles_since(start);
+    if (!ok)
+    {
+        reject_update(STAT_FAIL_AUTH);
+        return;
+    }
+    br_sha256_init(e->sha_ctx);
+    br_sha256_update(e->sha_ctx, slot->data, slot->len);
+    br_sha256_out(e->sha_ctx, e->manifest->leaves[slot->index]);
+
+    slot->state = SLOT_PLAIN;
+    e->decrypted++;
+    sched_signal(&flash_task);
+    if (e->slots[e->decrypted % CHUNK_SLOTS].state == SLOT_SEALED)
+    {
+        sched_signal(&crypto_task);
+    }
+}
+
+/*
+ * Flash task: program the oldest decrypted chunk, and enter its component
+ * in the table after its last one. With nothing to program yet, erase the
+ * page of the chunk that is arriving, once the component's first chunk has
+ * been authenticated.
+ */
+void flash_task_run(void)
+{
+    update_engine_t *e = &engine;
+    chunk_slot_t *slot = &e->slots[e->programmed % CHUNK_SLOTS];
+
+    if (!e->active || slot->state == SLOT_FREE)
+    {
+        return;
+    }
+
+    const comp_desc_t *desc = slot->desc;
+    uint32_t addr = comp_regions[desc->id].base + (slot->index * FLASH_PAGESIZE);
+
+    // Nothing of a component is touched before its first chunk has passed
+    // its tag, so a transport error or timeout before then keeps the
+    // installed copy
+    if (!(e->dropped & (1u << desc->id)) && slot->state != SLOT_PLAIN)
+    {
+        return;
+    }
+
+    // The installed copy is about to be overwritten: drop it from the table
+    // until the new one has been verified. Its version stays as the rollback
+    // floor.
+    if (!(e->dropped & (1u << desc->id)))
+    {
+        table_set(e->table, desc->id, e->table->comps[desc->id].version, 0, NULL);
+        program_flash(METADATA_BASE, (uint8_t *)e->table, sizeof(*e->table));
+        e->dropped |= 1u << desc->id;
+    }
+
+    if (slot->state != SLOT_PLAIN)
+    {
+        if (e->erased != addr)
+        {
+            erase_page(addr, 1);
+            e->erased = addr;
+        }
+        return;
+    }
+
+    if (e->erased == addr)
+    {
+        write_page(addr, slot->data, slot->len);
+    }
+    else
+    {
+        program_flash(addr, slot->data, slot->len);
+    }
+    e->erased = 0;
+
+    if (slot->index + 1 == desc->chunk_count)
+    {
+        // Last chunk: check the page hashes against the descriptor's root.
+        // The release message is printed as a string, so it must end in NUL.
+        uint8_t digest[DIGEST_SIZE];
+        bool ok = merkle_root(e->manifest->leaves[0], desc->chunk_count, digest);
+        uint8_t diff = 0;
+        for (int j = 0; j < DIGEST_SIZE; j++)
+        {
+            diff |= digest[j] ^ desc->digest[j];
+        }
+        if (!ok || diff != 0 || (desc->id == COMP_MESSAGE && slot->data[slot->len - 1] != '\0'))
+        {
+            reject_update(STAT_FAIL_DIGEST);
+            return;
+        }
+
+        // Keep the firmware's page hashes for boot-time checks
+        if (desc->id == COMP_FIRMWARE)
+        {
+            e->manifest->magic = MANIFEST_MAGIC;
+            e->manifest->leaf_count = desc->chunk_count;
+            program_flash(MANIFEST_BASE, (uint8_t *)e->manifest, sizeof(*e->manifest));
+        }
+
+        // Version 0 is a debug build: it installs but keeps the recorded version
+        uint16_t version = desc->version != 0 ? desc->version : e->table->comps[desc->id].version;
+        table_set(e->table, desc->id, version, desc->size, desc->digest);
+        program_flash(METADATA_BASE, (uint8_t *)e->table, sizeof(*e->table));
+        e->installed |= 1u << desc->id;
+
+        log_str("Installed component ");
+        log_dec(desc->id);
+        log_str("\n");
+    }
+
+    slot->state = SLOT_FREE;
+    e->programmed++;
+    sched_signal(&rx_task);
+    sched_signal(&crypto_task);
+    sched_signal(&flash_task);
+}
+
+/*
+ * Every chunk is in flash: count the success, acknowledge the zero length
+ * frame and go back to taking commands.
+ */
+void update_finish(void)
+{
+    update_engine_t *e = &engine;
+
+    stats_clock();
+    stats.successes++;
+    stats.last_duration_ms = update_cycles / (SysCtlClockGet() / 1000);
+    stats_save();
+
+    trace(TRACE_UPDATE_DONE, e->installed, 0);
+    updates_installed++;
+    uart_write(UART1, OK); // Acknowledge the zero length frame.
+    arena_release(e->arena_mark);
+    e->active = false;
+    if (e->link_count > 1)
+    {
+        stripe_enable(false);
+    }
+
+    uart_write_str(UART2, "Crypto time (us): ");
+    uart_write_dec(UART2, e->crypto_cycles / (SysCtlClockGet() / 1000000));
+    uart_write_str(UART2, " at ");
+    uart_write_dec(UART2, SysCtlClockGet());
+    uart_write_str(UART2, " Hz\nFrame check (cycles/frame): ");
+    uart_write_dec(UART2, e->frames ? e->check_cycles / e->frames : 0);
+    uart_write_str(UART2, e->frame_type != FRAME_SHA256 ? " crc32, " : " sha256, ");
+    uart_write_dec(UART2, e->frame_type != FRAME_SHA256 ? CRC32_SIZE : CHECKSUM_SIZE);
+    uart_write_str(UART2, " trailer bytes, ");
+    uart_write_dec(UART2, e->link_count);
+    uart_write_str(UART2, e->link_count > 1 ? " links\n" : " link\n");
+
+    clock_set_profile(CLOCK_PROFILE_DEFAULT);
+    uart_write_str(UART2, "Loaded new firmware.\n");
+    nl(UART2);
+
+    // The firmware asked for this update: tell it how it went and start it
+    if (e->requested)
+    {
+        mailbox_post(MAILBOX_REQ_NONE, MAILBOX_STATUS_OK, 0, e->installed);
+        boot_firmware();
+    }
+}
+
+/*
+ * Move the next bytes of the field a link is receiving from its ring to dst,
+ * without waiting. True once all need bytes are in; until then link->got
+ * keeps count, so the next call carries on where this one stopped.
+ */
+bool rx_take(rx_link_t *link, uint8_t *dst, uint32_t need)
+{
+    uint32_t head = *link->head;
+    uint32_t tail = *link->tail;
+
+    if (head == tail)
+    {
+        return false;
+    }
+    if (link->got == 0)
+    {
+        trace(TRACE_RX, need, (head - tail) & (RX_RING_SIZE - 1));
+    }
+
+    engine.idle_ms = 0;
+    while (link->got < need && head != tail)
+    {
+        dst[link->got++] = link->ring[tail];
+        tail = (tail + 1) & (RX_RING_SIZE - 1);
+    }
+    *link->tail = tail;
+    if (link->got < need)
+    {
+        return false;
+    }
+    link->got = 0;
+    return true;
+}
+
+/*
+ * Queue text for UART2. The log task sends it as the FIFO has room, so a
+ * message never holds up the task that logs it; text that does not fit in
+ * the ring is dropped.
+ */
+void log_str(const char *s)
+{
+    while (*s != '\0' && ((log_head + 1) & (LOG_RING_SIZE - 1)) != log_tail)
+    {
+        log_ring[log_head] = *s++;
+        log_head = (log_head + 1) & (LOG_RING_SIZE - 1);
+    }
+    sched_signal(&log_task);
+}
+
+void log_dec(uint32_t num)
+{
+    char digits[11];
+    int i = sizeof(digits) - 1;
+
+    digits[i] = '\0';
+    do
+    {
+        digits[--i] = '0' + (num % 10);
+        num /= 10;
+    } while (num > 0);
+    log_str(&digits[i]);
+}
+
+void log_task_run(void)
+{
+    while (log_tail != log_head && !(HWREG(UART2_BASE + UART_O_FR) & UART_FR_TXFF))
+    {
+        HWREG(UART2_BASE + UART_O_DR) = log_ring[log_tail];
+        log_tail = (log_tail + 1) & (LOG_RING_SIZE - 1);
+    }
+    if (log_tail != log_head)
+    {
+        sched_signal(&log_task);
+    }
+}
+
+/*
+ * Once a millisecond: keep the update's duration counted and fail an
+ * update whose host has gone quiet. Time the engine spends on its own work
+ * (a frame waiting for a slot, the final chunks) is not the host's silence.
+ */
+void tick_task_run(void)
+{
+    if (!engine.active)
+    {
+        return;
+    }
+    stats_clock();
+
+    if (engine.state == RX_PARSE || engine.state == RX_DRAIN)
+    {
+        return;
+    }
+#if UPDATE_TIMEOUT_MS
+    if (++engine.idle_ms >= UPDATE_TIMEOUT_MS)
+    {
+        reject_update(STAT_FAIL_FRAME); // counted with the other transport failures
+    }
+#endif
+}
+
+/*
+ * Any byte on UART2 asks for the engine's state and each task's share of
+ * the time. The answer goes through the log, so asking mid-update is safe.
+ */
+void diag_task_run(void)
+{
+    while (!(HWREG(UART2_BASE + UART_O_FR) & UART_FR_RXFE))
+    {
+        (void)HWREG(UART2_BASE + UART_O_DR);
+    }
+
+    if (engine.active)
+    {
+        log_str("Update: state ");
+        log_dec(engine.state);
+        log_str(", frames ");
+        log_dec(engine.frames);
+        log_str(", chunks programmed ");
+        log_dec(engine.programmed);
+        log_str(", in flight ");
+        log_dec(engine.filled - engine.programmed);
+        log_str("\n");
+    }
+    else
+    {
+        log_str("Idle\n");
+    }
+
+    task_t *task;
+    for (uint32_t i = 0; (task = sched_task(i)) != NULL; i++)
+    {
+        log_str(task->name);
+        log_str(": ");
+        log_dec(task->runs);
+        log_str(" runs, ");
+        log_dec(task->cycles);
+        log_str(" cycles\n");
+    }
+}
+
+/*
+ * Count the failure, tell the host the update failed and reset.
+ */
+void reject_update(uint32_t cause)
+{
+    stats_clock();
+    stats.failures[cause]++;
+    stats.last_duration_ms = update_cycles / (SysCtlClockGet() / 1000);
+    stats_save();
+    trace(TRACE_REJECT, cause, 0);
+
+    // A firmware that asked for the update gets its result and is started
+    // again after the reset, with whatever the update left installed
+    if (engine.requested)
+    {
+        mailbox_post(MAILBOX_REQ_BOOT, MAILBOX_STATUS_FAILED, cause, engine.installed);
+    }
+
+    uart_write(UART1, ERROR); // Reject the package.
+    SysCtlReset();            // Reset device
+}
@@ -0,0 +1,134 @@
+// Copyright 2023 The MITRE Corporation. ALL RIGHTS RESERVED
+// Approved for public release. Distribution unlimited 23-02181-13.
+
+/*
+ * Update engine: the receive, crypto and flash tasks that take a package
+ * from the host links into flash, and the tick, diag and log tasks that run
+ * beside them. The command loop in bootloader.c starts an update with
+ * update_start(); the engine finishes it, or rejects it and resets.
+ */
+#ifndef UPDATE_H
+#define UPDATE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <bearssl.h>
+#include "bootloader.h"
+#include "sched.h"
+
+// Update engine (see update_start)
+#define CHUNK_SLOTS 2 // chunks in flight between the receive, crypto and flash tasks
+#ifndef UPDATE_TIMEOUT_MS
+#define UPDATE_TIMEOUT_MS 5000 // host silence that fails an update, 0 to wait forever
+#endif
+#define LOG_RING_SIZE 512 // UART2 text queued by log_str (power of two)
+
+// Where the receive task is in the update protocol
+typedef enum
+{
+    RX_HEADER,     // package header
+    RX_DESCS,      // component descriptors
+    RX_HEADER_TAG, // GCM tag over both
+    RX_FRAMES,     // frames arriving on the host links
+    RX_PARSE,      // handing a checked frame's bytes on to chunk slots
+    RX_DRAIN,      // zero length frame seen, waiting for the last chunks
+} rx_state_t;
+
+// Where one host link is in the frame it is receiving
+typedef enum
+{
+    LINK_MARKER,  // frame start marker
+    LINK_SEQ,     // sequence number (striped frames only)
+    LINK_LENGTH,  // frame length
+    LINK_DATA,    // frame payload
+    LINK_TRAILER, // SHA-256 or CRC-32 trailer
+    LINK_READY,   // checked, waiting for its turn to be parsed
+} link_state_t;
+
+// Receive side of one host UART: its ring and its frame in progress
+typedef struct
+{
+    volatile uint8_t *ring;
+    volatile uint32_t *head; // advanced by the link's receive ISR
+    volatile uint32_t *tail;
+    link_state_t state;
+    uint32_t got; // bytes of the current field received so far
+    uint8_t *frame;
+    uint8_t field[CHECKSUM_SIZE]; // header tag, frame marker, sequence, length or trailer
+    uint32_t frame_type;
+    uint32_t frame_len;
+    uint32_t seq;
+    uint32_t crc; // running CRC-32 of the frame
+} rx_link_t;
+
+// A chunk on its way from the host to flash
+typedef enum
+{
+    SLOT_FREE,
+    SLOT_FILLING, // the receive task is copying frame bytes in
+    SLOT_SEALED,  // complete, waiting for the crypto task
+    SLOT_PLAIN,   // decrypted and hashed, waiting for the flash task
+} slot_state_t;
+
+typedef struct
+{
+    slot_state_t state;
+    const comp_desc_t *desc;
+    uint32_t index; // chunk number within the component
+    uint32_t len;   // plaintext bytes; the GCM tag follows them
+    uint32_t fill;
+    uint8_t *data;
+} chunk_slot_t;
+
+// The update in progress, shared by the engine's tasks. Slots are used in
+// turn; each task keeps a running count of the slots it has finished.
+typedef struct
+{
+    bool active;
+    bool requested; // started through the mailbox: boot the firmware afterwards
+    uint32_t arena_mark;
+    rx_state_t state;
+    package_t *pkg;
+    comp_table_t *table;
+    br_sha256_context *sha_ctx;
+    manifest_t *manifest;
+    rx_link_t links[RX_LINKS];
+    uint32_t link_count; // links the host sends frames on
+    rx_link_t *current;  // link whose frame is being parsed
+    uint32_t next_seq;   // sequence number of the frame parsed next
+    uint32_t frame_type; // of the last frame parsed
+    uint32_t parsed;     // frame bytes already handed on
+    const comp_desc_t *desc; // section being received, NULL between sections
+    uint8_t id_bytes[2];
+    uint32_t id_fill;
+    uint32_t next_index; // chunk of desc the receive task starts next
+    uint32_t seen;       // bit per component id whose section has started
+    uint32_t dropped;    // bit per component id taken out of the table
+    uint32_t installed;  // bit per component id installed by this update
+    chunk_slot_t slots[CHUNK_SLOTS];
+    uint32_t filled;     // slots sealed by the receive task
+    uint32_t decrypted;  // slots decrypted by the crypto task
+    uint32_t programmed; // slots programmed by the flash task
+    uint32_t erased;     // page erased ahead of its chunk, 0 if none
+    uint32_t idle_ms;    // since the host last sent anything
+    uint32_t crypto_cycles; // time spent in check_header and decrypt_aes
+    uint32_t check_cycles;  // time spent checking frame trailers
+    uint32_t frames;
+} update_engine_t;
+
+extern update_engine_t engine;
+
+// Tasks of the main loop, added after the command task in this order
+extern task_t rx_task;
+extern task_t crypto_task;
+extern task_t flash_task;
+extern task_t tick_task;
+extern task_t diag_task;
+extern task_t log_task;
+
+void update_start(uint32_t links);
+void reject_update(uint32_t cause);
+void log_str(const char *s);
+void log_dec(uint32_t num);
+
+#endif
@@ -0,0 +1,67 @@
+// Copyright 2023 The MITRE Corporation. ALL RIGHTS RESERVED
+// Approved for public release. Distribution unlimited 23-02181-13.
+
+#include <stddef.h>
+
+#include "handoff.h"
+#include "usart.h"
+
+// SYSCTL_CAUSE_* bits, lowest first
+static const char *const RESET_NAMES[] = {
+    "external", "power-on", "brown-out", "watchdog", "software", "LDO",
+};
+
+/*
+ * Return the handoff block if the bootloader wrote one this boot. A block
+ * from an older bootloader is accepted as long as it is at least as large as
+ * the version 1 layout.
+ */
+const handoff_t *handoff_get(void)
+{
+    const handoff_t *handoff = (const handoff_t *)HANDOFF_BASE;
+
+    if (handoff->magic != HANDOFF_MAGIC || handoff->version < 1 || handoff->size < sizeof(handoff_t))
+    {
+        return NULL;
+    }
+    return handoff;
+}
+
+/*
+ * Print the boot reason, versions and boot timing on UART2.
+ */
+void handoff_report(void)
+{
+    const handoff_t *handoff = handoff_get();
+
+    if (handoff == NULL)
+    {
+        writeLine("No handoff from the bootloader.");
+        return;
+    }
+
+    write("Reset cause:");
+    for (unsigned i = 0; i < sizeof(RESET_NAMES) / sizeof(RESET_NAMES[0]); i++)
+    {
+        if (handoff->reset_cause & (1u << i))
+        {
+            write(" ");
+            write(RESET_NAMES[i]);
+        }
+    }
+    write("\nUpdates installed before boot: ");
+    writeDec(handoff->updates);
+    write("\nFirmware version: ");
+    writeDec(handoff->fw_version);
+    write(" (");
+    writeDec(handoff->fw_size);
+    write(" bytes), message version ");
+    writeDec(handoff->msg_version);
+    write("\nClock (Hz): ");
+    writeDec(handoff->clock_hz);
+    write("\nImage check (cycles): ");
+    writeDec(handoff->verify_cycles);
+    write("\nBoot command to jump (cycles): ");
+    writeDec(handoff->boot_cycles);
+    writeLine("");
+}
@@ -0,0 +1,44 @@
+// Copyright 2023 The MITRE Corporation. ALL RIGHTS RESERVED
+// Approved for public release. Distribution unlimited 23-02181-13.
+
+/*
+ * What the bootloader left set up when it started the firmware. The block
+ * lives in the last 256 bytes of SRAM, which neither image places anything
+ * in, and is written just before the jump. Layout must match handoff_t in
+ * bootloader/src/bootloader.h; fields are only appended, so a newer block
+ * still reads correctly here.
+ */
+#ifndef HANDOFF_H
+#define HANDOFF_H
+
+#include <stdint.h>
+
+#define HANDOFF_BASE 0x2000FF00
+#define HANDOFF_MAGIC 0x31464F48 // "HOF1"
+#define HANDOFF_VERSION 1
+#define HANDOFF_UART0 (1u << 0)
+#define HANDOFF_UART1 (1u << 1)
+#define HANDOFF_UART2 (1u << 2)
+
+typedef struct
+{
+    uint32_t magic;
+    uint16_t version;
+    uint16_t size;
+    uint32_t clock_hz;
+    uint32_t clock_config;
+    uint32_t peripherals;   // HANDOFF_* bits: initialised and left enabled
+    uint32_t uart_baud;
+    uint32_t reset_cause;   // SysCtlResetCauseGet() bits
+    uint32_t updates;       // installed since that reset
+    uint16_t fw_version;
+    uint16_t msg_version;
+    uint32_t fw_size;
+    uint32_t verify_cycles;
+    uint32_t boot_cycles;
+} handoff_t;
+
+const handoff_t *handoff_get(void); // NULL if the bootloader left none
+void handoff_report(void);
+
+#endif
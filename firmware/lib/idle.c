@@ -0,0 +1,250 @@
+// Copyright 2023 The MITRE Corporation. ALL RIGHTS RESERVED
+// Approved for public release. Distribution unlimited 23-02181-13.
+
+#include "idle.h"
+#include "usart.h"
+
+#include "inc/hw_types.h"
+#include "inc/hw_memmap.h"
+#include "inc/hw_ints.h"
+#include "inc/hw_nvic.h"
+#include "inc/hw_uart.h"
+#include "driverlib/cpu.h"
+#include "driverlib/interrupt.h"
+#include "driverlib/sysctl.h"
+#include "driverlib/systick.h"
+
+#define SYSTICK_MAX 0x1000000 // 24-bit counter
+#define SYSTICK_MIN 1000      // shortest period, so the ISR cannot starve the loop
+
+// All reset by idle_init()
+static volatile uint64_t elapsed;  // clocks in completed SysTick periods
+static volatile uint32_t period;   // current SysTick period
+static volatile uint64_t deadline; // 0 when nothing is scheduled
+static volatile bool deadline_hit;
+static uint64_t sleep_ticks;
+static uint32_t sleeps;
+static volatile uint32_t wakes_rx;
+static volatile uint32_t wakes_timer;
+static uint32_t ticks_per_ms;
+
+static void idle_systick_isr(void);
+static void idle_uart2_isr(void);
+static void idle_program_period(void);
+
+/*
+ * Start timekeeping and make UART2 a wake-up source.
+ */
+void idle_init(void)
+{
+    elapsed = 0;
+    deadline = 0;
+    deadline_hit = false;
+    sleep_ticks = 0;
+    sleeps = 0;
+    wakes_rx = 0;
+    wakes_timer = 0;
+    ticks_per_ms = SysCtlClockGet() / 1000;
+
+    period = SYSTICK_MAX;
+    SysTickPeriodSet(period);
+    SysTickIntRegister(idle_systick_isr);
+    SysTickIntEnable();
+    SysTickEnable();
+
+    // The RX interrupt is only unmasked by idle_rx_pending() finding no byte
+    HWREG(UART2_BASE + UART_O_IM) &= ~(UART_IM_RXIM | UART_IM_RTIM);
+    IntRegister(INT_UART2, idle_uart2_isr);
+    IntEnable(INT_UART2);
+    IntMasterEnable();
+}
+
+/*
+ * Current time in SysTick clocks. Accounts for a wrap that happened while
+ * interrupts were masked and the ISR has not run yet.
+ */
+uint64_t idle_now(void)
+{
+    bool masked = IntMasterDisable();
+    uint32_t current = HWREG(NVIC_ST_CURRENT);
+    uint64_t now = elapsed + (period - 1 - current);
+
+    if (HWREG(NVIC_INT_CTRL) & NVIC_INT_CTRL_PENDSTSET)
+    {
+        now = elapsed + period + (period - 1 - HWREG(NVIC_ST_CURRENT));
+    }
+    if (!masked)
+    {
+        IntMasterEnable();
+    }
+    return now;
+}
+
+uint32_t idle_ms_to_ticks(uint32_t ms)
+{
+    return ms * ticks_per_ms;
+}
+
+/*
+ * Schedule a wake-up. SysTick is reloaded at once so the period ends at the
+ * deadline rather than after a full 24-bit count.
+ */
+void idle_set_deadline(uint64_t when)
+{
+    bool masked = IntMasterDisable();
+
+    // idle_now() counts a wrap whose interrupt is still pending; clear it so
+    // the ISR does not add a period again once interrupts are unmasked
+    elapsed = idle_now();
+    HWREG(NVIC_INT_CTRL) = NVIC_INT_CTRL_UNPEND_SYST;
+    deadline = when;
+    deadline_hit = false;
+    idle_program_period();
+    if (!masked)
+    {
+        IntMasterEnable();
+    }
+}
+
+bool idle_deadline_passed(void)
+{
+    return deadline_hit;
+}
+
+/*
+ * Sleep until the next interrupt of any kind.
+ */
+void idle_wait(void)
+{
+    IntMasterDisable();
+    uint64_t start = idle_now();
+    CPUwfi(); // wakes on a pending interrupt even while they are masked
+    sleep_ticks += idle_now() - start;
+    sleeps++;
+    IntMasterEnable(); // the waking ISR runs here
+}
+
+/*
+ * Check for a UART2 byte without sleeping. When there is none, the RX
+ * interrupt is armed so the next byte ends an idle_wait(); a byte that lands
+ * between the check and the arming still raises it.
+ */
+bool idle_rx_pending(void)
+{
+    if (!(HWREG(UART2_BASE + UART_O_FR) & UART_FR_RXFE))
+    {
+        return true;
+    }
+    HWREG(UART2_BASE + UART_O_IM) |= UART_IM_RXIM | UART_IM_RTIM;
+    return false;
+}
+
+#ifdef IDLE_SELFTEST
+/*
+ * Let SysTick wrap while a deadline is set and interrupts are masked, stop
+ * the counter, reschedule, and unmask. The wrap must be counted exactly
+ * once: elapsed moves by one period plus the clocks counted since the
+ * reload, and the ISR must not add another period afterwards. True if so.
+ */
+bool idle_selftest(void)
+{
+    IntMasterDisable();
+    idle_set_deadline(idle_now() + SYSTICK_MIN);
+    uint64_t before = elapsed;
+    uint32_t wrapped = period;
+    while (!(HWREG(NVIC_INT_CTRL) & NVIC_INT_CTRL_PENDSTSET))
+    {
+    }
+    SysTickDisable(); // freeze time so the result is exact
+    uint32_t current = HWREG(NVIC_ST_CURRENT);
+
+    idle_set_deadline(idle_now() + SYSTICK_MAX);
+    IntMasterEnable(); // a wrap still pending would run the ISR here
+    IntMasterDisable();
+    bool pass = elapsed == before + wrapped + (wrapped - 1 - current);
+
+    deadline_hit = false;
+    SysTickEnable();
+    idle_set_deadline(0);
+    IntMasterEnable();
+    return pass;
+}
+#endif
+
+/*
+ * Print run/sleep residency and wake-up counts on UART2.
+ */
+void idle_report(void)
+{
+    uint64_t total = idle_now();
+    uint64_t run = total - sleep_ticks;
+
+    write("Uptime (ms): ");
+    writeDec(total / ticks_per_ms);
+    write("\nRun (ms): ");
+    writeDec(run / ticks_per_ms);
+    write("\nSleep (ms): ");
+    writeDec(sleep_ticks / ticks_per_ms);
+    write("\nSleep residency (%): ");
+    writeDec(total ? (sleep_ticks * 100) / total : 0);
+    write("\nSleeps: ");
+    writeDec(sleeps);
+    write("\nWake-ups: rx ");
+    writeDec(wakes_rx);
+    write(", timer ");
+    writeDec(wakes_timer);
+    writeLine("");
+}
+
+/*
+ * A SysTick period ended: account for it and set up the next one. The time
+ * between the wrap and the reload below (a few clocks) is not counted.
+ */
+static void idle_systick_isr(void)
+{
+    elapsed += period;
+    if (deadline != 0 && elapsed >= deadline)
+    {
+        deadline = 0;
+        deadline_hit = true;
+        wakes_timer++;
+    }
+    idle_program_period();
+}
+
+/*
+ * Byte received: stop further RX interrupts, the data stays in the FIFO for
+ * uart_read().
+ */
+static void idle_uart2_isr(void)
+{
+    HWREG(UART2_BASE + UART_O_IM) &= ~(UART_IM_RXIM | UART_IM_RTIM);
+    HWREG(UART2_BASE + UART_O_ICR) = UART_ICR_RXIC | UART_ICR_RTIC;
+    wakes_rx++;
+}
+
+/*
+ * Run SysTick until the deadline, or for a full count when there is none
+ * (only needed to keep time).
+ */
+static void idle_program_period(void)
+{
+    uint64_t remaining = SYSTICK_MAX;
+
+    if (deadline != 0)
+    {
+        remaining = deadline > elapsed ? deadline - elapsed : SYSTICK_MIN;
+    }
+    if (remaining > SYSTICK_MAX)
+    {
+        remaining = SYSTICK_MAX;
+    }
+    if (remaining < SYSTICK_MIN)
+    {
+        remaining = SYSTICK_MIN;
+    }
+
+    period = remaining;
+    HWREG(NVIC_ST_RELOAD) = period - 1;
+    HWREG(NVIC_ST_CURRENT) = 0; // restart the count with the new reload
+}
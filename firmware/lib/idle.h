@@ -0,0 +1,28 @@
+// Copyright 2023 The MITRE Corporation. ALL RIGHTS RESERVED
+// Approved for public release. Distribution unlimited 23-02181-13.
+
+/*
+ * Tickless idle. The core sleeps in WFI until UART2 receives a byte or a
+ * scheduled deadline comes due; SysTick is reprogrammed for the next
+ * deadline instead of ticking periodically. Time spent running and asleep
+ * is counted for the IDLE command.
+ */
+#ifndef IDLE_H
+#define IDLE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+void idle_init(void);
+uint64_t idle_now(void);                 // SysTick clocks since idle_init()
+uint32_t idle_ms_to_ticks(uint32_t ms);
+void idle_set_deadline(uint64_t when);   // absolute idle_now() time, 0 for none
+bool idle_deadline_passed(void);
+void idle_wait(void);                    // sleep until the next interrupt
+bool idle_rx_pending(void);              // UART2 has a byte; if not, one will wake idle_wait()
+void idle_report(void);
+#ifdef IDLE_SELFTEST
+bool idle_selftest(void);                // a pending SysTick wrap is counted once
+#endif
+
+#endif
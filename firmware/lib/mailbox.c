@@ -0,0 +1,88 @@
+// Copyright 2023 The MITRE Corporation. ALL RIGHTS RESERVED
+// Approved for public release. Distribution unlimited 23-02181-13.
+
+#include "mailbox.h"
+#include "usart.h"
+
+#include <stdbool.h>
+#include "inc/hw_types.h"
+#include "inc/hw_memmap.h"
+#include "driverlib/interrupt.h"
+#include "driverlib/sysctl.h"
+#include "driverlib/uart.h"
+
+// Bootloader failure causes, in STAT_FAIL_* order
+static const char *const FAIL_NAMES[] = {
+    "format", "device", "downgrade", "auth", "frame", "sequence", "digest",
+};
+
+static void mailbox_post(uint32_t request, uint32_t status, uint32_t cause, uint32_t installed)
+{
+    mailbox_t *mailbox = (mailbox_t *)MAILBOX_BASE;
+
+    mailbox->request = request;
+    mailbox->status = status;
+    mailbox->cause = cause;
+    mailbox->installed = installed;
+    mailbox->check = ~(request ^ status ^ cause ^ installed);
+    mailbox->magic = MAILBOX_MAGIC;
+}
+
+/*
+ * Ask the bootloader to go straight into update mode and reset into it. It
+ * skips its banner and announces the update with "U" on UART1, and starts
+ * this firmware again when the update ends, successful or not.
+ */
+void mailbox_request_update(void)
+{
+    writeLine("Resetting into update mode.");
+    while (UARTBusy(UART2_BASE))
+    {
+    }
+
+    IntMasterDisable();
+    mailbox_post(MAILBOX_REQ_UPDATE, MAILBOX_STATUS_NONE, 0, 0);
+    SysCtlReset();
+}
+
+/*
+ * Print the result of an update this firmware requested, once: the result
+ * is cleared after it has been shown.
+ */
+void mailbox_report(void)
+{
+    const mailbox_t *mailbox = (const mailbox_t *)MAILBOX_BASE;
+
+    if (mailbox->magic != MAILBOX_MAGIC ||
+        mailbox->check != ~(mailbox->request ^ mailbox->status ^ mailbox->cause ^ mailbox->installed) ||
+        mailbox->status == MAILBOX_STATUS_NONE)
+    {
+        return;
+    }
+
+    if (mailbox->status == MAILBOX_STATUS_OK)
+    {
+        write("Requested update installed components:");
+    }
+    else if (mailbox->status == MAILBOX_STATUS_FAILED)
+    {
+        write("Requested update failed (");
+        write(mailbox->cause < sizeof(FAIL_NAMES) / sizeof(FAIL_NAMES[0]) ? FAIL_NAMES[mailbox->cause] : "unknown");
+        write("), installed components:");
+    }
+    else
+    {
+        write("Requested update did not finish, installed components:");
+    }
+    for (uint32_t id = 0; id < 32; id++)
+    {
+        if (mailbox->installed & (1u << id))
+        {
+            write(" ");
+            writeDec(id);
+        }
+    }
+    writeLine("");
+
+    mailbox_post(MAILBOX_REQ_NONE, MAILBOX_STATUS_NONE, 0, 0);
+}
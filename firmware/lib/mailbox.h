@@ -0,0 +1,39 @@
+// Copyright 2023 The MITRE Corporation. ALL RIGHTS RESERVED
+// Approved for public release. Distribution unlimited 23-02181-13.
+
+/*
+ * Mailbox shared with the bootloader in the last 64 bytes of SRAM, after the
+ * handoff block. Neither image places anything there and a software reset
+ * leaves it alone, so the firmware can ask for an update across a reset and
+ * find the result when it is started again. Layout must match mailbox_t in
+ * bootloader/src/bootloader.h.
+ */
+#ifndef MAILBOX_H
+#define MAILBOX_H
+
+#include <stdint.h>
+
+#define MAILBOX_BASE 0x2000FFC0
+#define MAILBOX_MAGIC 0x3158424D // "MBX1"
+#define MAILBOX_REQ_NONE 0
+#define MAILBOX_REQ_UPDATE 1
+#define MAILBOX_REQ_BOOT 2
+#define MAILBOX_STATUS_NONE 0
+#define MAILBOX_STATUS_RUNNING 1
+#define MAILBOX_STATUS_OK 2
+#define MAILBOX_STATUS_FAILED 3
+
+typedef struct
+{
+    uint32_t magic;
+    uint32_t request;   // MAILBOX_REQ_*, acted on once by the bootloader
+    uint32_t status;    // MAILBOX_STATUS_* of the last requested update
+    uint32_t cause;     // bootloader failure cause if it failed
+    uint32_t installed; // bit per component id it installed
+    uint32_t check;     // ~(request ^ status ^ cause ^ installed)
+} mailbox_t;
+
+void mailbox_request_update(void); // does not return
+void mailbox_report(void);
+
+#endif
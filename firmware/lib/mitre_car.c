@@ -4,6 +4,11 @@
 #include "mitre_car.h"
 #include "uart.h"
 #include "usart.h"
+#include "idle.h"
+#include "update_stats.h"
+#include "handoff.h"
+#include "mailbox.h"
+#include "sched.h"
 
 #include <string.h>
 
@@ -35,21 +40,66 @@ static const char *HELP_TEXT =
     " * SAFETY - Query safety system status\n"
     " * INFOTAINMENT - Query information/entertainment system status\n"
     " * SECURITY - Query cybersecurity system status\n"
+    " * IDLE - Query power management residency\n"
+    " * UPDATES - Query bootloader update statistics\n"
+    " * BOOT - Query boot reason and timing\n"
+    " * TASKS - Query task scheduling and run times\n"
+    " * REFLASH - Reset into the bootloader's update mode\n"
     " * FLAG - ???\n"
     "\n";
 
+// Subsystem tasks. The console (firmware.c) runs between the safety
+// monitor and the emissions test.
+#define SAFETY_PRIORITY 0
+#define EMISSIONS_PRIORITY 2
+#define SAFETY_PERIOD_MS 100
+#define EMISSIONS_STEPS 4
+#define EMISSIONS_STEP_MS 500
+
+static PT_THREAD(safety_task_run(task_t *task));
+static PT_THREAD(emissions_task_run(task_t *task));
+static task_t safety_task = {"safety", safety_task_run, SAFETY_PRIORITY, SAFETY_PERIOD_MS};
+static task_t emissions_task = {"emissions", emissions_task_run, EMISSIONS_PRIORITY, 0};
+static uint32_t safety_checks;
+static uint32_t emissions_step;
+static bool emissions_running;
+
 void printBanner()
 {
     write(STARTUP_BANNER);
 }
 
-int prompt(char* buffer, int max_bytes)
+void mitre_car_init(void)
+{
+    sched_add(&safety_task);
+    sched_add(&emissions_task);
+}
+
+/*
+ * Periodic safety monitor.
+ */
+static PT_THREAD(safety_task_run(task_t *task))
 {
-    write("->");
-    int len = readLine(buffer, max_bytes);
-    parseCommand(buffer, len);
+    PT_BEGIN(task);
+    safety_checks++;
+    PT_END(task);
+}
 
-    return len;
+/*
+ * Emissions self-test, started by the EMISSIONS command. It takes a couple
+ * of seconds but sleeps between steps, so the console stays responsive.
+ */
+static PT_THREAD(emissions_task_run(task_t *task))
+{
+    PT_BEGIN(task);
+    emissions_running = true;
+    for (emissions_step = 0; emissions_step < EMISSIONS_STEPS; emissions_step++)
+    {
+        PT_SLEEP(task, EMISSIONS_STEP_MS);
+    }
+    emissions_running = false;
+    writeLine("Emissions test done. Now that you mention it, the smoke usually isn't that color...");
+    PT_END(task);
 }
 
 void parseCommand(char* buffer, int len)
@@ -60,11 +110,21 @@ void parseCommand(char* buffer, int len)
     }
     else if(strncmp(buffer, "EMISSIONS", len) == 0)
     {
-        writeLine("Now that you mention it, the smoke usually isn't that color...");
+        if(emissions_running)
+        {
+            writeLine("Emissions test already running.");
+        }
+        else
+        {
+            writeLine("Emissions test started.");
+            sched_signal(&emissions_task);
+        }
     }
     else if(strncmp(buffer, "SAFETY", len) == 0)
     {
-        writeLine("System normal.");
+        write("System normal. Checks since boot: ");
+        writeDec(safety_checks);
+        writeLine("");
     }
     else if(strncmp(buffer, "INFOTAINMENT", len) == 0)
     {
@@ -76,6 +136,26 @@ void parseCommand(char* buffer, int len)
                   "Firewall disabled because it stops the airbags from "
                   "deploying.");
     }
+    else if(strncmp(buffer, "IDLE", len) == 0)
+    {
+        idle_report();
+    }
+    else if(strncmp(buffer, "UPDATES", len) == 0)
+    {
+        update_stats_report();
+    }
+    else if(strncmp(buffer, "BOOT", len) == 0)
+    {
+        handoff_report();
+    }
+    else if(strncmp(buffer, "TASKS", len) == 0)
+    {
+        sched_report();
+    }
+    else if(strcmp(buffer, "REFLASH") == 0) // resets the unit: no abbreviations
+    {
+        mailbox_request_update();
+    }
     else if(strncmp(buffer, "FLAG", len) == 0);
     else
     {
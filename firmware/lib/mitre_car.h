@@ -3,4 +3,4 @@
 
 void printBanner(void);
 void parseCommand(char* buffer, int len);
-int prompt(char* buffer, int max_bytes);
+void mitre_car_init(void); // add the subsystem tasks
@@ -0,0 +1,169 @@
+// Copyright 2023 The MITRE Corporation. ALL RIGHTS RESERVED
+// Approved for public release. Distribution unlimited 23-02181-13.
+
+#include <stddef.h>
+
+#include "sched.h"
+#include "idle.h"
+#include "usart.h"
+
+#include "driverlib/interrupt.h"
+
+static task_t *tasks = NULL; // sorted by priority, then by order added
+
+/*
+ * Insert a task behind every task of the same or a higher priority.
+ */
+void sched_add(task_t *task)
+{
+    task_t **link = &tasks;
+
+    while (*link != NULL && (*link)->priority <= task->priority)
+    {
+        link = &(*link)->next;
+    }
+    task->next = *link;
+    *link = task;
+
+    task->lc = 0;
+    task->waiting = false;
+    task->wake = 0;
+    task->release = idle_now();
+}
+
+void sched_signal(task_t *task)
+{
+    task->ready = true;
+}
+
+/*
+ * Release periodic and sleeping tasks that are due, and return the earliest
+ * time one will be due next (0 for none).
+ */
+static uint64_t sched_release(uint64_t now)
+{
+    uint64_t next = 0;
+
+    for (task_t *t = tasks; t != NULL; t = t->next)
+    {
+        if (t->period != 0)
+        {
+            if (now >= t->release)
+            {
+                // A release missed by more than a period is dropped, not queued up
+                uint64_t period = idle_ms_to_ticks(t->period);
+                t->release = now - t->release >= period ? now + period : t->release + period;
+                t->ready = true;
+            }
+            next = (next == 0 || t->release < next) ? t->release : next;
+        }
+        if (t->wake != 0)
+        {
+            if (now >= t->wake)
+            {
+                t->wake = 0;
+                t->ready = true;
+            }
+            else
+            {
+                next = (next == 0 || t->wake < next) ? t->wake : next;
+            }
+        }
+    }
+    return next;
+}
+
+// Something may have changed what a waiting task waits on
+static void sched_recheck(void)
+{
+    for (task_t *t = tasks; t != NULL; t = t->next)
+    {
+        if (t->waiting)
+        {
+            t->ready = true;
+        }
+    }
+}
+
+void sched_start(void)
+{
+    for (;;)
+    {
+        uint64_t next = sched_release(idle_now());
+
+        task_t *t = tasks;
+        while (t != NULL && !t->ready)
+        {
+            t = t->next;
+        }
+
+        if (t == NULL)
+        {
+            // Sleep until the next release or any interrupt. The ready flags
+            // are checked again with interrupts masked, so a signal from an
+            // ISR in between still wakes the core at once.
+            IntMasterDisable();
+            for (t = tasks; t != NULL && !t->ready; t = t->next)
+            {
+            }
+            if (t == NULL)
+            {
+                idle_set_deadline(next);
+                idle_wait();
+                sched_recheck();
+            }
+            IntMasterEnable();
+            continue;
+        }
+
+        t->ready = false;
+        uint64_t start = idle_now();
+        int result = t->run(t);
+        uint64_t clocks = idle_now() - start;
+
+        t->runs++;
+        t->clocks += clocks;
+        if (clocks > t->max_clocks)
+        {
+            t->max_clocks = clocks;
+        }
+
+        t->waiting = result == PT_WAITING;
+        if (result == PT_YIELDED)
+        {
+            t->ready = true;
+        }
+        if (result != PT_WAITING)
+        {
+            sched_recheck();
+        }
+    }
+}
+
+/*
+ * Print each task's priority, period, runs and time spent running on UART2.
+ */
+void sched_report(void)
+{
+    uint32_t per_ms = idle_ms_to_ticks(1);
+
+    for (task_t *t = tasks; t != NULL; t = t->next)
+    {
+        write(t->name);
+        write(": priority ");
+        writeDec(t->priority);
+        if (t->period != 0)
+        {
+            write(", every ");
+            writeDec(t->period);
+            write(" ms");
+        }
+        write(", ");
+        writeDec(t->runs);
+        write(" runs, ");
+        writeDec((t->clocks * 1000) / per_ms);
+        write(" us total, ");
+        writeDec(((uint64_t)t->max_clocks * 1000) / per_ms);
+        writeLine(" us longest");
+    }
+}
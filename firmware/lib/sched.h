@@ -0,0 +1,92 @@
+// Copyright 2023 The MITRE Corporation. ALL RIGHTS RESERVED
+// Approved for public release. Distribution unlimited 23-02181-13.
+
+/*
+ * Cooperative scheduler with protothread tasks.
+ *
+ * A task is a function written between PT_BEGIN and PT_END. It keeps no
+ * stack of its own: PT_WAIT_UNTIL, PT_SLEEP and PT_YIELD return to the
+ * scheduler, and the next call resumes at the same line. Locals do not
+ * survive those points, so task state lives in statics.
+ *
+ * A task runs when it is released (every period), signalled (sched_signal,
+ * also from an ISR), due after PT_SLEEP, or when it waits on a condition
+ * that may have changed: after any interrupt, or after another task made
+ * progress. The ready task with the lowest priority number runs first; a
+ * task that keeps yielding holds off every lower priority. With nothing
+ * ready the core sleeps (see idle.h) until the next release or interrupt.
+ */
+#ifndef SCHED_H
+#define SCHED_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "idle.h"
+
+// What a task body returns to the scheduler
+#define PT_WAITING 0 // blocked in PT_WAIT_UNTIL or PT_SLEEP
+#define PT_YIELDED 1 // more to do, after the other ready tasks
+#define PT_ENDED 2   // done until the next release or signal
+
+typedef struct task task_t;
+struct task
+{
+    // Set by the owner
+    const char *name;
+    int (*run)(task_t *task);
+    uint8_t priority;  // 0 runs first
+    uint32_t period;   // ms between releases, 0 for event-triggered only
+
+    // Scheduler state
+    uint16_t lc;       // line to resume at, 0 for the top
+    volatile bool ready;
+    bool waiting;
+    uint64_t release;  // next periodic release, idle_now() clocks
+    uint64_t wake;     // end of PT_SLEEP, 0 if not sleeping
+    task_t *next;
+
+    // Accounting, in SysTick clocks
+    uint32_t runs;
+    uint64_t clocks;
+    uint32_t max_clocks;
+};
+
+#define PT_THREAD(decl) int decl
+
+#define PT_BEGIN(t) switch ((t)->lc) { case 0:
+
+#define PT_END(t) } (t)->lc = 0; return PT_ENDED
+
+#define PT_WAIT_UNTIL(t, cond)  \
+    do                          \
+    {                           \
+        (t)->lc = __LINE__;     \
+    case __LINE__:              \
+        if (!(cond))            \
+        {                       \
+            return PT_WAITING;  \
+        }                       \
+    } while (0)
+
+#define PT_YIELD(t)             \
+    do                          \
+    {                           \
+        (t)->lc = __LINE__;     \
+        return PT_YIELDED;      \
+    case __LINE__:;             \
+    } while (0)
+
+#define PT_SLEEP(t, ms)                                          \
+    do                                                           \
+    {                                                            \
+        (t)->wake = idle_now() + idle_ms_to_ticks(ms);           \
+        PT_WAIT_UNTIL(t, (t)->wake == 0);                        \
+    } while (0)
+
+void sched_add(task_t *task);     // before sched_start(); periodic tasks first run at once
+void sched_signal(task_t *task);  // make it ready; safe from an ISR
+void sched_start(void);           // run the tasks, never returns
+void sched_report(void);
+
+#endif
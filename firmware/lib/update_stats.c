@@ -0,0 +1,73 @@
+// Copyright 2023 The MITRE Corporation. ALL RIGHTS RESERVED
+// Approved for public release. Distribution unlimited 23-02181-13.
+
+#include "update_stats.h"
+#include "usart.h"
+
+static const char *const FAIL_NAMES[STAT_FAIL_CAUSES] = {
+    "format", "device", "downgrade", "auth", "frame", "sequence", "digest",
+};
+
+/*
+ * Find the newest complete record, the same way the bootloader's
+ * stats_load() does.
+ */
+const update_stats_t *update_stats_get(void)
+{
+    const update_stats_t *latest = 0;
+
+    for (int i = 0; i < STATS_PAGES; i++)
+    {
+        const update_stats_t *rec = (const update_stats_t *)(STATS_BASE + (i * STATS_PAGESIZE));
+        if (rec->magic == STATS_MAGIC && rec->commit == ~rec->seq && (latest == 0 || rec->seq > latest->seq))
+        {
+            latest = rec;
+        }
+    }
+    return latest;
+}
+
+/*
+ * Print the update statistics and the most erased flash page on UART2.
+ */
+void update_stats_report(void)
+{
+    const update_stats_t *stats = update_stats_get();
+
+    if (stats == 0)
+    {
+        writeLine("No update statistics recorded.");
+        return;
+    }
+
+    write("Updates: ");
+    writeDec(stats->attempts);
+    write(" attempted, ");
+    writeDec(stats->successes);
+    write(" succeeded\nFailures:");
+    for (int i = 0; i < STAT_FAIL_CAUSES; i++)
+    {
+        write(" ");
+        write(FAIL_NAMES[i]);
+        write(" ");
+        writeDec(stats->failures[i]);
+    }
+    write("\nBytes received: ");
+    writeDec(stats->bytes_received);
+    write("\nLast update (ms): ");
+    writeDec(stats->last_duration_ms);
+
+    int worst = 0;
+    for (int i = 1; i < STATS_FLASH_PAGES; i++)
+    {
+        if (stats->erase_counts[i] > stats->erase_counts[worst])
+        {
+            worst = i;
+        }
+    }
+    write("\nMost erased page: ");
+    writeDec(worst);
+    write(" (");
+    writeDec(stats->erase_counts[worst]);
+    writeLine(" erases)");
+}
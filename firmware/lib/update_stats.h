@@ -0,0 +1,37 @@
+// Copyright 2023 The MITRE Corporation. ALL RIGHTS RESERVED
+// Approved for public release. Distribution unlimited 23-02181-13.
+
+/*
+ * Read-only view of the bootloader's update statistics. The bootloader keeps
+ * the record in a ring of flash pages at STATS_BASE; the newest complete one
+ * is current. Layout must match update_stats_t in bootloader/src/bootloader.h.
+ */
+#ifndef UPDATE_STATS_H
+#define UPDATE_STATS_H
+
+#include <stdint.h>
+
+#define STATS_BASE 0x3F000
+#define STATS_PAGES 4
+#define STATS_PAGESIZE 1024
+#define STATS_MAGIC 0x31545355 // "UST1"
+#define STATS_FLASH_PAGES 256
+#define STAT_FAIL_CAUSES 7
+
+typedef struct
+{
+    uint32_t magic;
+    uint32_t seq;
+    uint32_t attempts;
+    uint32_t successes;
+    uint32_t failures[STAT_FAIL_CAUSES]; // format, device, downgrade, auth, frame, sequence, digest
+    uint32_t bytes_received;
+    uint32_t last_duration_ms;
+    uint16_t erase_counts[STATS_FLASH_PAGES];
+    uint32_t commit;
+} update_stats_t;
+
+const update_stats_t *update_stats_get(void); // NULL if no record was saved yet
+void update_stats_report(void);
+
+#endif
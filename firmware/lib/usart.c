@@ -3,30 +3,33 @@
 
 #include "usart.h"
 #include "uart.h"
+#include "idle.h"
 
-int readLine(char *buffer, int max_bytes)
+/*
+ * Move whatever UART2 has received into buffer, without waiting. Returns
+ * true once the line has ended (or filled the buffer), with the string
+ * terminated and *len its length; until then call again with *len as left.
+ */
+bool readLinePoll(char *buffer, int *len, int max_bytes)
 {
-    int i;
     int ret;
-    for (i = 0;i < max_bytes; ++i)
+    while (idle_rx_pending())
     {
-        // Fetch the received byte value into the variable "received_byte".
         char received_byte = uart_read(UART2, 1, &ret);
-        // If the line has ended, terminate the string and break. Otherwise,
-        // store the byte and contintue.
-        if(received_byte == '\n' || received_byte == '\r')
+        if (received_byte == '\n' || received_byte == '\r')
         {
-            buffer[i] = '\0';
-            break;
+            buffer[*len] = '\0';
+            return true;
         }
-        else
+
+        buffer[(*len)++] = received_byte;
+        if (*len == max_bytes - 1)
         {
-            buffer[i] = received_byte;
+            buffer[*len] = '\0';
+            return true;
         }
     }
-
-    // Reture number of bytes received (length of string).
-    return i;
+    return false;
 }
 
 void write(const char *buffer)
@@ -40,6 +43,20 @@ void writeLine(const char *buffer)
     nl(UART2);
 }
 
+void writeDec(uint32_t num)
+{
+    char digits[11];
+    int i = sizeof(digits) - 1;
+
+    digits[i] = '\0';
+    do
+    {
+        digits[--i] = '0' + (num % 10);
+        num /= 10;
+    } while (num > 0);
+    write(&digits[i]);
+}
+
 void initializeUSART()
 {
     uart_init(UART2);
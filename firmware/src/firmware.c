@@ -8,27 +8,66 @@
 #include "uart.h"
 #include "util.h"
 #include "mitre_car.h"
+#include "idle.h"
+#include "handoff.h"
+#include "mailbox.h"
+#include "sched.h"
 
 
+#define CONSOLE_PRIORITY 1
+#define LINE_SIZE 256
+
 static const char *FLAG_RESPONSE = "Nice try.";
 
+static PT_THREAD(console_task_run(task_t *task));
+static task_t console_task = {"console", console_task_run, CONSOLE_PRIORITY, 0};
+static char line[LINE_SIZE];
+static int line_len;
+
 void getFlag(char *flag)
 {
     flag = strcpy(flag, FLAG_RESPONSE);
 }
 
-int main(void) __attribute__((section(".text.main")));
-int main (void)
+/*
+ * The command prompt, one task among the others: it waits for each line
+ * without holding up the subsystem tasks.
+ */
+static PT_THREAD(console_task_run(task_t *task))
 {
+    PT_BEGIN(task);
     printBanner();
     for(;;) // Loop forever.
     {
-        char buff[256];
-        int len = prompt(buff, 256);
-        if(buff[0] != '\0' && strncmp(buff, "FLAG", len) == 0)
+        write("->");
+        line_len = 0;
+        PT_WAIT_UNTIL(task, readLinePoll(line, &line_len, LINE_SIZE));
+        parseCommand(line, line_len);
+        if(line[0] != '\0' && strncmp(line, "FLAG", line_len) == 0)
         {
-            getFlag(buff);
-            writeLine(buff);
+            getFlag(line);
+            writeLine(line);
         }
     }
+    PT_END(task);
+}
+
+int main (void)
+{
+    // The bootloader normally leaves UART2 ready; only set it up when it says otherwise
+    const handoff_t *handoff = handoff_get();
+    if(handoff == NULL || !(handoff->peripherals & HANDOFF_UART2))
+    {
+        initializeUSART();
+    }
+    mailbox_report(); // Result of an update requested with REFLASH, if any
+
+    idle_init();
+#ifdef IDLE_SELFTEST
+    writeLine(idle_selftest() ? "Idle self-test: pass" : "Idle self-test: FAIL");
+#endif
+    mitre_car_init();
+    sched_add(&console_task);
+    sched_signal(&console_task);
+    sched_start();
 }
@@ -18,6 +18,7 @@ import string
 import secrets
 
 from Crypto.Random import get_random_bytes
+from Crypto.Cipher import AES
 
 REPO_ROOT = pathlib.Path(__file__).parent.parent.absolute()
 BOOTLOADER_DIR = os.path.join(REPO_ROOT, "bootloader")
@@ -30,6 +31,64 @@ def copy_initial_firmware(binary_path: str):
     shutil.copy(binary_path, os.path.join(BOOTLOADER_DIR, "src/firmware.bin"))
 
 
+def aes_sbox():
+    # Multiplicative inverse in GF(2^8), then the AES affine map
+    def mul(a, b):
+        p = 0
+        while b:
+            if b & 1:
+                p ^= a
+            a = ((a << 1) ^ (0x11B if a & 0x80 else 0)) & 0x1FF
+            b >>= 1
+        return p
+
+    sbox = []
+    for x in range(256):
+        inv = next((y for y in range(1, 256) if mul(x, y) == 1), 0)
+        s = inv
+        for shift in range(1, 5):
+            s ^= ((inv << shift) | (inv >> (8 - shift))) & 0xFF
+        sbox.append(s ^ 0x63)
+    return sbox
+
+
+def gcm_precompute(key: bytes):
+    """
+    The parts of AES-128-GCM that depend on the key alone, so the bootloader
+    never derives them: the 44 round keys as big-endian words, the GHASH key
+    H = AES(key, 0^128), and the 16 multiples of H used by aes_cm3's 4-bit
+    GHASH. Must match key_expand() and the GHASH table layout in aes_cm3.c.
+    """
+    sbox = aes_sbox()
+    rk = [int.from_bytes(key[4 * i:4 * i + 4], "big") for i in range(4)]
+    rcon = 1
+    for i in range(4, 44):
+        t = rk[i - 1]
+        if i % 4 == 0:
+            t = ((t << 8) | (t >> 24)) & 0xFFFFFFFF
+            t = int.from_bytes(bytes(sbox[b] for b in t.to_bytes(4, "big")), "big") ^ (rcon << 24)
+            rcon = ((rcon << 1) ^ (0x11B if rcon & 0x80 else 0)) & 0xFF
+        rk.append(rk[i - 4] ^ t)
+
+    h = AES.new(key, AES.MODE_ECB).encrypt(bytes(16))
+
+    # htab[i] = i * H, the nibble's top bit being the first coefficient
+    htab = [0] * 16
+    htab[8] = int.from_bytes(h, "big")
+    for i in (4, 2, 1):
+        v = htab[i << 1]
+        htab[i] = (v >> 1) ^ ((0xE1 << 120) if v & 1 else 0)
+    for i in (2, 4, 8):
+        for j in range(1, i):
+            htab[i + j] = htab[i] ^ htab[j]
+    htab = [[(v >> (96 - 32 * k)) & 0xFFFFFFFF for k in range(4)] for v in htab]
+    return rk, h, htab
+
+
+def c_words(words):
+    return "{" + ", ".join(f"0x{w:08X}" for w in words) + "}"
+
+
 def make_bootloader() -> bool:
     # Build the bootloader from source.
 
@@ -64,6 +123,9 @@ if __name__ == "__main__":
         gcmkey.append(''.join(secrets.choice(string.ascii_letters + string.digits + '~!@#$%^&*()_+=_{[]}|"/.,')))
         cbckey.append(''.join(secrets.choice(string.ascii_letters + string.digits + '~!@#$%^&*()_+=_{[]}|"/.,')))
 
+    # Packages name the device they are built for; others are turned away on the first header bytes
+    device_id = secrets.randbits(32)
+
     AAD = "AccordingtoallknownlawsofaviationthereisnowayabeeshouldbeabletoflyItswingsaretoosmalltogetitsfatlittlebodyoffthegroundThebeeofcoursefliesanywaybecausebeesdontcarewhathumansthink"
 
     currentpath = os.path.realpath(__file__)
@@ -78,6 +140,8 @@ if __name__ == "__main__":
         file.write(x)
     file.write('\n')
     file.write(AAD)
+    file.write('\n')
+    file.write(str(device_id))
     file.close #closes "secret_build_output.txt"
 
     currentpath = os.path.realpath(__file__)
@@ -95,19 +159,30 @@ if __name__ == "__main__":
         file.write('\',')
     file.write('};')
     file.write('\n')
+    file.write('#ifdef CRYPTO_BENCH\n') #the raw gcm key is only needed by crypto_bench()'s reference run
     file.write('const char gcmkey[16] = {') #writes gcm key to the header file with "C" syntax
     for x in gcmkey:
         file.write('\'')
         file.write(x)
         file.write('\',')
     file.write('};')
-    file.write('\n')
+    file.write('\n#endif\n')
     file.write('const char aad[177] = {') #writes AAD to the header file with "C" syntax
     for x in AAD:
         file.write('\'')
         file.write(x)
         file.write('\',')
     file.write('};')
+    file.write('\n')
+    file.write(f'const unsigned long device_id = 0x{device_id:08X};')
+    file.write('\n')
+
+    # Key-dependent GCM state, so decrypt_aes() starts from it instead of
+    # expanding gcmkey for every chunk
+    rk, h, htab = gcm_precompute(''.join(gcmkey).encode())
+    file.write(f'#define GCM_ROUND_KEYS {c_words(rk)}\n')
+    file.write('#define GCM_H {' + ', '.join(f'0x{b:02X}' for b in h) + '}\n')
+    file.write('#define GCM_HTAB {' + ', '.join(c_words(row) for row in htab) + '}')
     file.write("\n#endif")
     file.close()
 
@@ -5,50 +5,306 @@
 
 import argparse
 import pathlib
+import shutil
+import socket
 import subprocess
+import sys
+import tempfile
 import os
 from util import *
 
+FLASH_DIR = "/flash"  # where the QEMU fork keeps the device's flash contents
+SNAPSHOT_TAG = "idle"
+VMSTATE_SIZE = "64M"  # room in the snapshot image for saved RAM and device state
+INITIAL_VERSION = 2   # what load_initial_firmware() installs the firmware and message as
+SELF_TEST_TIMEOUT = 10.0  # seconds to wait for a restored device to answer
 
-def emulate(binary_path, debug=False):
-    cmd = ["qemu-system-arm", "-M", "lm3s6965evb", "-nographic", "-kernel", binary_path]
+
+def monitor_path(sock_dir):
+    # HMP monitor socket of the instance whose UART sockets live in sock_dir
+    return os.path.join(sock_dir, "monitor")
+
+
+def image_flash_dir(image_path):
+    # Live flash contents of the instance running from a snapshot image
+    return image_path + ".flash"
+
+
+def saved_flash_dir(image_path, tag):
+    # Flash contents stored with snapshot tag
+    return os.path.join(image_path + ".snap", tag)
+
+
+def copy_flash(src, dst):
+    # Replace the files in dst with those in src, keeping dst itself (it may be mounted)
+    os.makedirs(dst, exist_ok=True)
+    for name in os.listdir(dst):
+        os.remove(os.path.join(dst, name))
+    if os.path.isdir(src):
+        for name in os.listdir(src):
+            shutil.copyfile(os.path.join(src, name), os.path.join(dst, name))
+
+
+def create_flash_image(image_path):
+    """
+    Create a snapshot image. The lm3s6965evb machine has no block device, so
+    the qcow2 file is an unattached drive that only stores savevm state. The
+    flash the fork writes under /flash lives next to it in image_flash_dir(),
+    and each snapshot keeps a copy of it in saved_flash_dir().
+    """
+    for path in (image_flash_dir(image_path), image_path + ".snap"):
+        shutil.rmtree(path, ignore_errors=True)
+    os.makedirs(image_flash_dir(image_path))
+    if os.path.exists(image_path):
+        os.remove(image_path)
+    subprocess.run(["qemu-img", "create", "-q", "-f", "qcow2", image_path, VMSTATE_SIZE], check=True)
+
+
+def clone_flash_image(src, dst):
+    # Snapshots live inside the qcow2 file; the flash copies sit beside it
+    shutil.copyfile(src, dst)
+    for suffix in (".flash", ".snap"):
+        shutil.rmtree(dst + suffix, ignore_errors=True)
+        if os.path.isdir(src + suffix):
+            shutil.copytree(src + suffix, dst + suffix)
+
+
+UNSHARE = ["unshare", "--user", "--map-root-user", "--mount", "--"]
+_private_flash_checked = False
+
+
+def check_private_flash():
+    """
+    Make sure this host can bind a directory over /flash in a private mount
+    namespace: unshare must exist and unprivileged user namespaces must be
+    enabled. Otherwise isolated instances would all write the shared /flash,
+    so refuse to start them. Checked once per process.
+    """
+    global _private_flash_checked
+    if _private_flash_checked:
+        return
+    if not os.path.isdir(FLASH_DIR):
+        raise RuntimeError(f"ERROR: {FLASH_DIR} must exist to be replaced per instance")
+
+    with tempfile.TemporaryDirectory() as probe_dir:
+        # The probe file must land in probe_dir, not in the real /flash
+        try:
+            probe = subprocess.run(UNSHARE + ["sh", "-c", f'mount --bind "$0" {FLASH_DIR} && touch {FLASH_DIR}/.probe', probe_dir],
+                                   capture_output=True, text=True)
+            reason = probe.stderr.strip() or f"exit status {probe.returncode}"
+        except FileNotFoundError:
+            probe, reason = None, "unshare not found"
+        if probe is None or probe.returncode != 0 or not os.path.exists(os.path.join(probe_dir, ".probe")):
+            if probe is not None and probe.returncode == 0:
+                reason = f"the bind mount did not replace {FLASH_DIR}"
+            raise RuntimeError(f"ERROR: cannot give this instance a private {FLASH_DIR} ({reason}). "
+                               "Isolated emulators need unshare and unprivileged user namespaces "
+                               "(e.g. sysctl kernel.unprivileged_userns_clone=1 or user.max_user_namespaces > 0).")
+    _private_flash_checked = True
+
+
+def private_flash(cmd, flash_dir):
+    """
+    The fork always uses /flash, so give the instance a mount namespace of its
+    own with flash_dir bound over /flash. The exec chain keeps qemu's pid, so
+    the returned Popen still controls qemu itself.
+    """
+    check_private_flash()
+    return UNSHARE + ["sh", "-c", f'mount --bind "$0" {FLASH_DIR} && exec "$@"', os.path.abspath(flash_dir)] + cmd
+
+
+def emulate(binary_path, debug=False, sock_dir=SOCK_DIR, flash_dir=None, snapshot_image=None, loadvm=None):
+    """
+    Start one emulated device.
+
+    With the default arguments this behaves like the original tool: every
+    other qemu is killed and the shared /embsec sockets and /flash contents are
+    wiped. Passing a private sock_dir and flash_dir leaves other instances
+    alone, so several devices can run side by side on one host: flash_dir is
+    mounted over /flash for this qemu only (see private_flash).
+
+    snapshot_image is a snapshot image (see create_flash_image) that keeps
+    flash contents and VM snapshots across runs; the instance then also gets a
+    monitor socket for save_snapshot()/restore_snapshot(). With loadvm the
+    VM starts from that snapshot instead of cold from reset.
+    """
+    cmd = ["qemu-system-arm", "-M", "lm3s6965evb", "-nographic", "-kernel", str(binary_path)]
 
     if debug:
         cmd.extend(["-s", "-S"])
 
-    uart_paths = ["/embsec/UART0", "/embsec/UART1", "/embsec/UART2"]
+    isolated = flash_dir is not None or snapshot_image is not None
+    if snapshot_image is not None:
+        flash_dir = image_flash_dir(snapshot_image)
+        cmd.extend(["-drive", f"if=none,id=vmstate,format=qcow2,file={snapshot_image}"])
+        cmd.extend(["-monitor", f"unix:{monitor_path(sock_dir)},server,nowait"])
+        if loadvm is not None:
+            copy_flash(saved_flash_dir(snapshot_image, loadvm), flash_dir)
+            cmd.extend(["-loadvm", loadvm])
+
+    uart_paths_list = uart_paths(sock_dir)
     for i in range(3):
-        cmd.extend(["-serial", f"unix:{uart_paths[i]},server"])
-    
-    # Try to kill and delete leftover stuff before starting qemu
-    os.system("pkill qemu")
+        cmd.extend(["-serial", f"unix:{uart_paths_list[i]},server"])
+
+    if isolated:
+        # Only clean up what belongs to this instance
+        os.makedirs(sock_dir, exist_ok=True)
+        for path in uart_paths_list + [monitor_path(sock_dir)]:
+            if os.path.exists(path):
+                os.remove(path)
+        if snapshot_image is None:
+            # Start erased, like the shared /flash after the wipe below
+            shutil.rmtree(flash_dir, ignore_errors=True)
+            os.makedirs(flash_dir)
+        cmd = private_flash(cmd, flash_dir)
+    else:
+        # Try to kill and delete leftover stuff before starting qemu
+        os.system("pkill qemu")
+        for path in uart_paths_list:
+            try:
+                os.system(f"rm -rf {path}")
+            except:
+                pass
+        os.system("rm -rf /flash/*")
+
+    return subprocess.Popen(cmd)
+
+
+def save_snapshot(sock_dir, image_path, tag=SNAPSHOT_TAG):
+    # Stop the VM, store RAM and device state in its image and copy its flash
+    mon = QemuMonitor(monitor_path(sock_dir))
     try:
-        os.system(f"rm -rf {UART0_PATH}")
-    except:
-        pass
+        mon.command("stop")
+        mon.command(f"savevm {tag}")
+        copy_flash(image_flash_dir(image_path), saved_flash_dir(image_path, tag))
+        mon.command("cont")
+    finally:
+        mon.close()
+
+
+def restore_snapshot(sock_dir, image_path, tag=SNAPSHOT_TAG):
+    # Put a running VM back into a saved state, e.g. between test cases
+    mon = QemuMonitor(monitor_path(sock_dir))
+    try:
+        mon.command("stop")
+        copy_flash(saved_flash_dir(image_path, tag), image_flash_dir(image_path))
+        mon.command(f"loadvm {tag}")
+        mon.command("cont")
+    finally:
+        mon.close()
+
+
+def make_warm_image(binary_path, image_path, sock_dir, tag=SNAPSHOT_TAG, firmware=None):
+    """
+    Boot a device cold once, let load_initial_firmware() finish, optionally
+    install a protected firmware package, and save the VM idle at the U/B
+    prompt as snapshot tag in image_path. Later runs start from it with
+    emulate(..., snapshot_image=image_path, loadvm=tag).
+    """
+    from fw_update import update  # fw_update imports this module's helpers
 
+    create_flash_image(image_path)
+    proc = emulate(binary_path, sock_dir=sock_dir, snapshot_image=image_path)
     try:
-        os.system(f"rm -rf {UART1_PATH}")
-    except:
-        pass
+        uart0_path, uart1_path, uart2_path = uart_paths(sock_dir)
+        uart0 = connect_socket(uart0_path)
+        uart1 = DomainSocketSerial(connect_socket(uart1_path))
+        uart2 = DomainSocketSerial(connect_socket(uart2_path))
 
+        # The banner is printed once initial firmware is in flash
+        while b"Send" not in uart2.readline():
+            pass
+        if firmware is not None:
+            update(ser=uart1, infile=firmware, debug=False)
+
+        save_snapshot(sock_dir, image_path, tag)
+        for ser in (uart1, uart2):
+            ser.close()
+        uart0.close()
+    finally:
+        proc.kill()
+        proc.wait()
+
+
+def expected_versions(firmware=None):
+    # Component versions a warm image holds: the initial ones, then the package's
+    from fw_update import split_package
+
+    versions = {0: INITIAL_VERSION, 1: INITIAL_VERSION}
+    if firmware is not None:
+        with open(firmware, "rb") as fp:
+            _, sections = split_package(fp.read())
+        for comp_id, (version, _, _), _ in sections:
+            versions[comp_id] = version
+    return versions
+
+
+def self_test(binary_path, image_path, sock_dir, tag=SNAPSHOT_TAG, firmware=None):
+    """
+    Build a warm image, start a new instance from it and check that the
+    restored bootloader answers 'Q' at the U/B prompt with the component
+    versions that were installed before the save. Then restore the snapshot
+    in the running instance and check again, so both -loadvm and
+    restore_snapshot() bring back flash that matches the VM state. Returns
+    True if every check passed.
+    """
+    from fw_update import connect, query_device
+
+    expected = expected_versions(firmware)
+    make_warm_image(binary_path, image_path, sock_dir, tag=tag, firmware=firmware)
+
+    passed = True
+    proc = emulate(binary_path, sock_dir=sock_dir, snapshot_image=image_path, loadvm=tag)
     try:
-        os.system(f"rm -rf {UART2_PATH}")
-    except:
-        pass
-    os.system("rm -rf /flash/*")
-    
-    subprocess.Popen(cmd)
+        uart1 = connect(sock_dir, timeout=SELF_TEST_TIMEOUT)
+        for stage in ("-loadvm", "restore_snapshot()"):
+            if stage == "restore_snapshot()":
+                restore_snapshot(sock_dir, image_path, tag)
+            try:
+                installed = {i: v[0] for i, v in query_device(uart1)["installed"].items()}
+            except (RuntimeError, socket.timeout, EOFError) as e:
+                installed = f"no answer ({e or type(e).__name__})"
+            ok = installed == expected
+            passed = passed and ok
+            print(f"{'PASS' if ok else 'FAIL'} after {stage}: installed {installed}, expected {expected}")
+        uart1.close()
+    finally:
+        proc.kill()
+        proc.wait()
+    return passed
 
 
 if __name__ == "__main__":
     parser = argparse.ArgumentParser(description="Stellaris Emulator")
     parser.add_argument("--boot-path", help="Path to the the bootloader binary.", default=None)
     parser.add_argument("--debug", help="Start GDB server and break on first instruction", action="store_true")
+    parser.add_argument("--sock-dir", help="Directory for the UART0-2 sockets.", default=SOCK_DIR)
+    parser.add_argument("--flash-dir", help="Private directory mounted over /flash (isolates this instance).", default=None)
+    parser.add_argument("--snapshot-image", help="qcow2 image that keeps VM snapshots across runs; flash is kept next to it.", default=None)
+    parser.add_argument("--save-snapshot", help="Build --snapshot-image: boot cold, install --firmware if given, save the idle VM under this tag, exit.", default=None)
+    parser.add_argument("--load-snapshot", help="Start from this snapshot in --snapshot-image instead of from reset.", default=None)
+    parser.add_argument("--firmware", help="Protected firmware to install before --save-snapshot or --self-test.", default=None)
+    parser.add_argument("--self-test", help="Build --snapshot-image, start from it and check the restored device's component versions.", action="store_true")
     args = parser.parse_args()
     if args.boot_path is None:
         binary_path = (pathlib.Path(__file__).parent / ".." / "bootloader" / "gcc" / "main.axf")
     else:
         binary_path = pathlib.Path(args.boot_path)
 
-    emulate(binary_path.resolve(), debug=args.debug)
+    if (args.save_snapshot or args.load_snapshot or args.self_test) and args.snapshot_image is None:
+        parser.error("--save-snapshot, --load-snapshot and --self-test need --snapshot-image")
+
+    if args.flash_dir or args.snapshot_image:
+        try:
+            check_private_flash()
+        except RuntimeError as e:
+            sys.exit(str(e))
+
+    if args.self_test:
+        tag = args.save_snapshot or SNAPSHOT_TAG
+        sys.exit(0 if self_test(binary_path.resolve(), args.snapshot_image, args.sock_dir, tag=tag, firmware=args.firmware) else 1)
+    elif args.save_snapshot:
+        make_warm_image(binary_path.resolve(), args.snapshot_image, args.sock_dir, tag=args.save_snapshot, firmware=args.firmware)
+    else:
+        emulate(binary_path.resolve(), debug=args.debug, sock_dir=args.sock_dir, flash_dir=args.flash_dir,
+                snapshot_image=args.snapshot_image, loadvm=args.load_snapshot)
@@ -0,0 +1,137 @@
+#!/usr/bin/env python
+
+# Copyright 2023 The MITRE Corporation. ALL RIGHTS RESERVED
+# Approved for public release. Distribution unlimited 23-02181-13.
+
+"""
+Bootloader Trace Decoder
+
+Asks the bootloader to dump its binary event trace ('T' on UART1), reads the
+ring from UART2 and prints it as a timeline, followed by the time spent in
+decryption and flash programming. The ring survives software resets, so it
+can be pulled after a rejected update as well.
+
+python3 bl_trace.py [--sock-dir /embsec] [--save trace.bin]
+python3 bl_trace.py --input trace.bin
+"""
+
+import argparse
+import struct
+
+from util import *
+
+TRACE_MAGIC = b"TRC1"
+ENTRY_FMT = "<IIII"  # time (core clocks), event, arg0, arg1
+ENTRY_SIZE = struct.calcsize(ENTRY_FMT)
+DEFAULT_HZ = 8000000  # until the first BOOT or CLOCK event says otherwise
+FAIL_CAUSES = ["format", "device", "downgrade", "auth", "frame", "sequence", "digest"]
+
+# Event ids from bootloader/src/trace.h: name and how to show the arguments
+EVENTS = {
+    1: ("BOOT", lambda a, b: f"{a} Hz"),
+    2: ("CLOCK", lambda a, b: f"profile {a}, {b} Hz"),
+    3: ("UPDATE_START", lambda a, b: ""),
+    4: ("HEADER", lambda a, b: f"{a} components, {'accepted' if b else 'rejected'}"),
+    5: ("REJECT", lambda a, b: FAIL_CAUSES[a] if a < len(FAIL_CAUSES) else str(a)),
+    6: ("UPDATE_DONE", lambda a, b: f"installed {[i for i in range(32) if a & (1 << i)]}"),
+    7: ("RX", lambda a, b: f"{a} bytes, {b} buffered"),
+    8: ("FRAME", lambda a, b: f"{a} bytes"),
+    9: ("ACK", lambda a, b: f"0x{a:02x}"),
+    10: ("SECTION", lambda a, b: f"component {a}, {b} chunks"),
+    11: ("DECRYPT", lambda a, b: f"nonce 0x{a:08x}, {b} bytes"),
+    12: ("DECRYPT_DONE", lambda a, b: f"nonce 0x{a:08x}, {'ok' if b else 'BAD TAG'}"),
+    13: ("ERASE", lambda a, b: f"page 0x{a:05x}{', ahead of its data' if b else ''}"),
+    14: ("PROGRAM_DONE", lambda a, b: f"page 0x{a:05x}, {'ok' if b == 0 else 'ACCESS ERROR'}"),
+    15: ("BOOT_FW", lambda a, b: f"version {a}"),
+}
+
+
+def pull_trace(sock_dir=SOCK_DIR, timeout=10.0):
+    # Trigger the dump on UART1 and return the raw ring (header and entries) from UART2
+    _, uart1_path, uart2_path = uart_paths(sock_dir)
+    uart1 = DomainSocketSerial(connect_socket(uart1_path), timeout=timeout)
+    uart2 = DomainSocketSerial(connect_socket(uart2_path), timeout=timeout)
+    try:
+        uart1.write(b"T")
+        if uart1.read_exact(1) != b"T":
+            raise RuntimeError("ERROR: Bootloader did not answer the trace request")
+
+        # UART2 also carries text; the dump starts at the magic
+        window = b""
+        while window != TRACE_MAGIC:
+            window = (window + uart2.read_exact(1))[-len(TRACE_MAGIC):]
+        kept, count = struct.unpack("<II", uart2.read_exact(8))
+        entries = uart2.read_exact(kept * ENTRY_SIZE) if kept else b""
+        return TRACE_MAGIC + struct.pack("<II", kept, count) + entries
+    finally:
+        uart1.close()
+        uart2.close()
+
+
+def decode(raw):
+    # Parse a dump into (events recorded since power-on, [(time, event, arg0, arg1)])
+    if raw[:4] != TRACE_MAGIC:
+        raise ValueError("ERROR: not a bootloader trace dump")
+    kept, count = struct.unpack_from("<II", raw, 4)
+    entries = [struct.unpack_from(ENTRY_FMT, raw, 12 + i * ENTRY_SIZE) for i in range(kept)]
+    return count, entries
+
+
+def render(count, entries):
+    """
+    Print one line per event with its time in microseconds. Times are core
+    clocks, so each stretch is converted at the clock rate last reported by a
+    BOOT or CLOCK event.
+    """
+    if count > len(entries):
+        print(f"({count - len(entries)} older events were overwritten)")
+
+    hz = DEFAULT_HZ
+    now_us = 0.0
+    prev = entries[0][0] if entries else 0
+    open_spans = {}
+    totals = {"decrypt": [0, 0.0], "flash": [0, 0.0]}
+
+    print("      time (us)     +delta  event          details")
+    for clocks, event, arg0, arg1 in entries:
+        delta_us = ((clocks - prev) & 0xFFFFFFFF) * 1e6 / hz
+        now_us += delta_us
+        prev = clocks
+
+        name, fmt = EVENTS.get(event, (f"EVENT_{event}", lambda a, b: f"0x{a:08x} 0x{b:08x}"))
+        print(f"{now_us:15.1f} {delta_us:10.1f}  {name:<14} {fmt(arg0, arg1)}")
+
+        if event in (1, 2):
+            hz = arg0 if event == 1 else arg1
+        elif event == 11:
+            open_spans["decrypt"] = now_us
+        elif event == 13:
+            open_spans["flash"] = now_us
+        elif event in (12, 14):
+            span = "decrypt" if event == 12 else "flash"
+            if span in open_spans:
+                totals[span][0] += 1
+                totals[span][1] += now_us - open_spans.pop(span)
+
+    for span, (n, us) in totals.items():
+        if n:
+            print(f"{span}: {n} operations, {us:.1f} us total, {us / n:.1f} us each")
+
+
+if __name__ == "__main__":
+    parser = argparse.ArgumentParser(description="Bootloader Trace Decoder")
+    parser.add_argument("--sock-dir", help="Directory holding the device's UART0-2 sockets.", default=SOCK_DIR)
+    parser.add_argument("--input", help="Decode a dump saved with --save instead of asking the device.", default=None)
+    parser.add_argument("--save", help="Also write the raw dump to this file.", default=None)
+    args = parser.parse_args()
+
+    if args.input:
+        with open(args.input, "rb") as fp:
+            raw = fp.read()
+    else:
+        raw = pull_trace(args.sock_dir)
+    if args.save:
+        with open(args.save, "wb") as fp:
+            fp.write(raw)
+
+    render(*decode(raw))
@@ -0,0 +1,106 @@
+#!/usr/bin/env python
+
+# Copyright 2023 The MITRE Corporation. ALL RIGHTS RESERVED
+# Approved for public release. Distribution unlimited 23-02181-13.
+
+"""
+Multi-Device Update Orchestrator
+
+Launches several emulated devices, each with its own socket directory and
+flash directory, and pushes a protected firmware image to all of them at
+the same time. Prints per-device and aggregate throughput and failure counts.
+
+python3 fw_orchestrate.py --firmware protected_firmware.bin --devices 4
+"""
+
+import argparse
+import os
+import pathlib
+import shutil
+import sys
+import tempfile
+import time
+from concurrent.futures import ThreadPoolExecutor
+
+from util import *
+from bl_emulate import check_private_flash, emulate
+from fw_update import connect, update
+
+RESPONSE_TIMEOUT = 30.0  # seconds before a silent device counts as failed
+
+
+def run_device(index, binary_path, work_dir, firmware_path, debug=False):
+    # Bring up one device, update it, and return its result record
+    sock_dir = os.path.join(work_dir, f"dev{index}")
+    flash_dir = os.path.join(work_dir, f"dev{index}.flash")
+    result = {"device": index, "firmware": firmware_path, "bytes": os.path.getsize(firmware_path), "ok": False, "error": None, "seconds": 0.0}
+
+    proc = emulate(binary_path, sock_dir=sock_dir, flash_dir=flash_dir)
+    try:
+        ser = connect(sock_dir, timeout=RESPONSE_TIMEOUT)
+        start = time.monotonic()
+        try:
+            update(ser=ser, infile=firmware_path, debug=debug)
+            result["ok"] = True
+        finally:
+            result["seconds"] = time.monotonic() - start
+            ser.close()
+    except Exception as e:
+        result["error"] = str(e)
+    finally:
+        proc.kill()
+        proc.wait()
+    return result
+
+
+def report(results, wall_seconds):
+    print("\ndev  ok    bytes   seconds   B/s       firmware")
+    for r in results:
+        rate = r["bytes"] / r["seconds"] if r["seconds"] > 0 else 0.0
+        print(f"{r['device']:<4} {'yes' if r['ok'] else 'NO':<5} {r['bytes']:<7} {r['seconds']:<9.3f} {rate:<9.1f} {r['firmware']}")
+        if r["error"]:
+            print(f"     error: {r['error']}")
+
+    ok = [r for r in results if r["ok"]]
+    total_bytes = sum(r["bytes"] for r in ok)
+    print(f"\nDevices: {len(results)}  Succeeded: {len(ok)}  Failed: {len(results) - len(ok)}")
+    print(f"Wall time: {wall_seconds:.3f} s  Aggregate throughput: {total_bytes / wall_seconds if wall_seconds > 0 else 0.0:.1f} B/s")
+
+
+if __name__ == "__main__":
+    parser = argparse.ArgumentParser(description="Multi-Device Update Orchestrator")
+    parser.add_argument("--boot-path", help="Path to the the bootloader binary.", default=None)
+    parser.add_argument("--firmware", help="Protected firmware image(s); assigned to devices round-robin.", nargs="+", required=True)
+    parser.add_argument("--devices", help="Number of emulated devices to launch.", type=int, default=2)
+    parser.add_argument("--work-dir", help="Directory for per-device sockets and flash directories.", default=None)
+    parser.add_argument("--debug", help="Enable debugging messages.", action="store_true")
+    args = parser.parse_args()
+
+    if args.boot_path is None:
+        binary_path = (pathlib.Path(__file__).parent / ".." / "bootloader" / "gcc" / "main.axf").resolve()
+    else:
+        binary_path = pathlib.Path(args.boot_path).resolve()
+
+    # Refuse to start devices that would share one /flash
+    try:
+        check_private_flash()
+    except RuntimeError as e:
+        sys.exit(str(e))
+
+    work_dir = args.work_dir or tempfile.mkdtemp(prefix="embsec-")
+    os.makedirs(work_dir, exist_ok=True)
+    firmwares = [os.path.abspath(f) for f in args.firmware]
+
+    start = time.monotonic()
+    with ThreadPoolExecutor(max_workers=args.devices) as pool:
+        futures = [
+            pool.submit(run_device, i, binary_path, work_dir, firmwares[i % len(firmwares)], args.debug)
+            for i in range(args.devices)
+        ]
+        results = [f.result() for f in futures]
+    wall_seconds = time.monotonic() - start
+
+    report(results, wall_seconds)
+
+    if args.work_dir is None:
+        shutil.rmtree(work_dir, ignore_errors=True)
@@ -6,82 +6,246 @@
 """
 Firmware Bundle-and-Protect Tool
 
+python3 fw_protect.py --batch releases.json [--jobs 8] [--cache-dir .fw_cache]
+
+A batch manifest is a JSON list of packages, each an object with the same
+fields as the command line (infile, outfile, version, message and optionally
+message_version, config, config_version). Paths are relative to the manifest.
 """
 import argparse
+import json
+import shutil
 import struct
+import time
 import cryptography
 import os
+from concurrent.futures import ProcessPoolExecutor
 from Crypto.Hash import SHA256
 from Crypto.Cipher import AES
 from Crypto.PublicKey import RSA
 from Crypto.Cipher import AES, PKCS1_OAEP
-from Crypto.Util.Padding import pad
-from pwn import p16
 
-def protect_firmware(infile, outfile, version, message):
-    # Load firmware binary from infile
-    with open(infile, 'rb') as fp:
-        firmware = fp.read()
+PKG_MAGIC = b"BWS3"
+PKG_FORMAT = 3
+CHUNK_SIZE = 1024                 # one LM3S6965 flash page of plaintext per chunk
+HEADER_NONCE_INDEX = 0xFFFFFFFF   # nonce index reserved for the header's own tag
+HEADER_FMT = "<4sHHHHI8s"         # magic, format, component count, chunk size, reserved, device id, nonce base
+DESC_FMT = "<HHIHH32s"            # id, version, size, chunk count, reserved, Merkle root of page hashes
+
+# Component ids, each with its own flash region and size limit on the device
+COMP_FIRMWARE = 0
+COMP_MESSAGE = 1
+COMP_CONFIG = 2
+COMP_MAX_SIZE = {COMP_FIRMWARE: 15000, COMP_MESSAGE: 1024, COMP_CONFIG: 1024}
+
+# Bump when the package layout or its crypto changes, so cached packages
+# built by an older tool are never reused
+CACHE_VERSION = b"fw_protect v3.1"
 
 
-    # Pack version and size into two little-endian shorts
-    metadata = struct.pack('<HH', version, len(firmware))
-    version_pack = p16(version, endian = "little")
+def chunk_nonce(nonce_base, index):
+    # 96-bit GCM nonce: random per-package base followed by the big-endian nonce index
+    return nonce_base + struct.pack(">I", index)
 
-    # Hash the firmware using SHA-256
-    hash = SHA256.new()
-    hash.update(firmware)
-    firmware_hash = bytes(hash.digest())
 
-    # Load secrets for encryption and signing
+def comp_nonce_index(comp_id, chunk):
+    # Chunks of different components never share a nonce
+    return (comp_id << 16) | chunk
+
+
+def merkle_root(data):
+    # Root of a Merkle tree over the SHA-256 of each flash page of data. Each
+    # level hashes pairs of nodes; an odd node out moves up unchanged, so a
+    # one-page component's root is just its SHA-256. Must match merkle_root()
+    # in bootloader.c.
+    level = [SHA256.new(data[i:i + CHUNK_SIZE]).digest() for i in range(0, len(data), CHUNK_SIZE)]
+    while len(level) > 1:
+        parents = [SHA256.new(level[i] + level[i + 1]).digest() for i in range(0, len(level) - 1, 2)]
+        if len(level) % 2:
+            parents.append(level[-1])
+        level = parents
+    return level[0]
+
+
+def load_secrets():
     with open("secret_build_output.txt", 'rb') as secrets_fp:
         aes_key1 = secrets_fp.readline() #pulls cbc key from file
         aes_key2 = secrets_fp.readline() #pulls gcm key from file
         gcm_aad = secrets_fp.readline() #pulls aad from file
+        device_id = int(secrets_fp.readline()) #pulls device id from file
 
         aes_key1 = aes_key1[0:-1] #drops newline character
         aes_key2 = aes_key2[0:-1] #drops newline character
-    # Make an IV
-    aes_cbc_iv = os.urandom(16) 
-    aes_gcm_nonce = os.urandom(16) #for aes gcm 
-
-    # Encrypt firmware + hash with AES-CBC
-    firmware_all = firmware + firmware_hash
-    cipher = AES.new(aes_key1, AES.MODE_CBC,iv=aes_cbc_iv)
-    if len(firmware_all)%16 !=0:
-        firmware_all = pad(firmware_all,16)
-    ciphertext = cipher.encrypt(firmware_all)
-
-    # Encrypt version + message + previous message + CBC_IV with AES-GCM
-    cipher = AES.new(aes_key2, AES.MODE_GCM, nonce = aes_gcm_nonce)
-    cipher.update(gcm_aad)
-
-    msg_size = p16(len(message.encode()), endian = "little")
-    ciphertext_all = version_pack + msg_size + message.encode() + ciphertext + aes_cbc_iv 
-    
-    ciphertext_final, tag = cipher.encrypt_and_digest(pad(ciphertext_all,16))
-    length_pack = p16(len(ciphertext_final ), endian = "little")
-    ciphertext_final = length_pack + ciphertext_final + aes_gcm_nonce + tag
+        gcm_aad = gcm_aad[0:-1] #drops newline character
+    return aes_key1, aes_key2, gcm_aad, device_id
+
+
+def load_components(infile, version, message, config=None, message_version=None, config_version=None):
+    # [(id, version, data)] for one package, checked against the device's limits
+    with open(infile, 'rb') as fp:
+        firmware = fp.read()
+
+    # Each component is installed on its own; the release message keeps its NUL
+    components = [
+        (COMP_FIRMWARE, version, firmware),
+        (COMP_MESSAGE, version if message_version is None else message_version, message.encode() + b"\x00"),
+    ]
+    if config is not None:
+        with open(config, 'rb') as fp:
+            components.append((COMP_CONFIG, version if config_version is None else config_version, fp.read()))
+
+    for comp_id, _, data in components:
+        if not 0 < len(data) <= COMP_MAX_SIZE[comp_id]:
+            raise ValueError(f"Component {comp_id} is {len(data)} bytes, limit is {COMP_MAX_SIZE[comp_id]}")
+    return components
+
+
+def build_package(components, secrets):
+    # A fresh nonce base every time: a package is only ever rebuilt with new nonces
+    _, gcm_key, gcm_aad, device_id = secrets
+
+    nonce_base = os.urandom(8)
+    header = struct.pack(HEADER_FMT, PKG_MAGIC, PKG_FORMAT, len(components), CHUNK_SIZE, 0, device_id, nonce_base)
+    for comp_id, comp_version, data in components:
+        chunk_count = (len(data) + CHUNK_SIZE - 1) // CHUNK_SIZE
+        header += struct.pack(DESC_FMT, comp_id, comp_version, len(data), chunk_count, 0, merkle_root(data))
+
+    # Authenticate the header and descriptors so the bootloader can vet them before any chunk
+    cipher = AES.new(gcm_key, AES.MODE_GCM, nonce=chunk_nonce(nonce_base, HEADER_NONCE_INDEX))
+    cipher.update(gcm_aad + header)
+    package = [header, cipher.digest()]
+
+    # One section per component: its id, then its chunks, each encrypted and
+    # authenticated independently and bound to the header
+    for comp_id, _, data in components:
+        package.append(struct.pack("<H", comp_id))
+        for i in range(0, len(data), CHUNK_SIZE):
+            cipher = AES.new(gcm_key, AES.MODE_GCM, nonce=chunk_nonce(nonce_base, comp_nonce_index(comp_id, i // CHUNK_SIZE)))
+            cipher.update(gcm_aad + header)
+            ciphertext, tag = cipher.encrypt_and_digest(data[i:i + CHUNK_SIZE])
+            package += [ciphertext, tag]
+    return b"".join(package)
+
+
+def cache_key(components, secrets):
+    """
+    Content address of a package: the digest of every input that changes its
+    plaintext or keys (component ids, versions and data, and the device's
+    keys, AAD and id). The secrets only enter as part of the digest.
+    """
+    digest = SHA256.new(CACHE_VERSION)
+    for value in secrets:
+        field = value if isinstance(value, bytes) else str(value).encode()
+        digest.update(struct.pack("<I", len(field)) + field)
+    for comp_id, comp_version, data in components:
+        digest.update(struct.pack("<HHI", comp_id, comp_version, len(data)) + SHA256.new(data).digest())
+    return digest.hexdigest()
+
+
+def protect_firmware(infile, outfile, version, message, config=None, message_version=None, config_version=None,
+                     secrets=None, cache_dir=None):
+    """
+    Package the given components into outfile. With cache_dir, a package
+    built earlier from the same inputs is copied instead of rebuilt; a
+    rebuilt one is stored there. Returns (cache key, True if it was a hit).
+    """
+    components = load_components(infile, version, message, config, message_version, config_version)
+    if secrets is None:
+        secrets = load_secrets()
+
+    key = cache_key(components, secrets)
+    cached = os.path.join(cache_dir, key + ".bin") if cache_dir else None
+    if cached and os.path.exists(cached):
+        shutil.copyfile(cached, outfile)
+        return key, True
+
+    package = build_package(components, secrets)
+
     # Write firmware blob to outfile
-    with open(outfile, 'wb+') as outfile:
-        outfile.write(ciphertext_final)
+    with open(outfile, 'wb+') as fp:
+        fp.write(package)
+
+    # Written under a temporary name and renamed, so a concurrent job never
+    # reads half a package
+    if cached:
+        os.makedirs(cache_dir, exist_ok=True)
+        tmp = f"{cached}.{os.getpid()}.tmp"
+        with open(tmp, 'wb') as fp:
+            fp.write(package)
+        os.replace(tmp, cached)
+    return key, False
+
+
+def protect_entry(entry, secrets, cache_dir):
+    # One manifest entry, run in a worker process; returns its result record
+    start = time.monotonic()
+    key, hit = protect_firmware(infile=entry["infile"], outfile=entry["outfile"], version=int(entry["version"]),
+                                message=entry["message"], config=entry.get("config"),
+                                message_version=entry.get("message_version"), config_version=entry.get("config_version"),
+                                secrets=secrets, cache_dir=cache_dir)
+    return {"outfile": entry["outfile"], "key": key, "hit": hit, "seconds": time.monotonic() - start}
+
+
+def protect_batch(manifest, jobs=None, cache_dir=None):
+    """
+    Package every entry of a manifest file across jobs worker processes
+    (default: one per core). The secrets are read once and handed to the
+    workers.
+    """
+    with open(manifest) as fp:
+        entries = json.load(fp)
+    base = os.path.dirname(os.path.abspath(manifest))
+    for entry in entries:
+        for field in ("infile", "outfile", "config"):
+            if entry.get(field) is not None:
+                entry[field] = os.path.join(base, entry[field])
+
+    secrets = load_secrets()
+    start = time.monotonic()
+    with ProcessPoolExecutor(max_workers=jobs) as pool:
+        results = list(pool.map(protect_entry, entries, [secrets] * len(entries), [cache_dir] * len(entries)))
+    wall = time.monotonic() - start
+
+    for r in results:
+        print(f"{'cached' if r['hit'] else 'built ':<7} {r['seconds']:7.3f} s  {r['key'][:16]}  {r['outfile']}")
+    hits = sum(r["hit"] for r in results)
+    print(f"Packages: {len(results)}  Built: {len(results) - hits}  From cache: {hits}  Wall time: {wall:.3f} s")
+    return results
 
 #python3 fw_protect.py --infile firmware.ld --outfile protected_firmware.bin --version 1.0.0 --message "Update Message"
 
 if __name__ == '__main__':
     parser = argparse.ArgumentParser(description='Firmware Update Tool')
-    parser.add_argument("--infile", help="Path to the firmware image to protect.", required=True)
-    parser.add_argument("--outfile", help="Filename for the output firmware.", required=True)
-    parser.add_argument("--version", help="Version number of this firmware.", required=True)
-    parser.add_argument("--message", help="Release message for this firmware.", required=True)
+    parser.add_argument("--infile", help="Path to the firmware image to protect.")
+    parser.add_argument("--outfile", help="Filename for the output firmware.")
+    parser.add_argument("--version", help="Version number of this firmware.")
+    parser.add_argument("--message", help="Release message for this firmware.")
+    parser.add_argument("--message-version", help="Version of the release message (defaults to --version).", type=int, default=None)
+    parser.add_argument("--config", help="Optional config blob to include as its own component.", default=None)
+    parser.add_argument("--config-version", help="Version of the config blob (defaults to --version).", type=int, default=None)
+    parser.add_argument("--batch", help="JSON manifest of packages to build instead of a single one.", default=None)
+    parser.add_argument("--jobs", help="Worker processes for --batch (defaults to one per core).", type=int, default=None)
+    parser.add_argument("--cache-dir", help="Reuse packages built from identical inputs, keyed by their digest.", default=None)
     args = parser.parse_args()
 
-    protect_firmware(infile=args.infile, outfile=args.outfile, version=int(args.version), message=args.message)
-
-
-
-
-                  # size verison msg_size message        firmware , hash 0x20 , CBC_IV 0x10, GCM_Nonce, tag
- #Encrypt1                                      #AES_CBC ENCRYPTION#                                #Decrypt2
- #Encrypt2               ############### AES_GCM #################################                  #Decrypt1
-                         #########3###### LENGTH  ################################
\ No newline at end of file
+    if args.batch:
+        protect_batch(args.batch, jobs=args.jobs, cache_dir=args.cache_dir)
+        raise SystemExit(0)
+    if None in (args.infile, args.outfile, args.version, args.message):
+        parser.error("--infile, --outfile, --version and --message are required without --batch")
+
+    protect_firmware(infile=args.infile, outfile=args.outfile, version=int(args.version), message=args.message,
+                     config=args.config, message_version=args.message_version, config_version=args.config_version,
+                     cache_dir=args.cache_dir)
+
+
+# v3 package layout (all integers little-endian unless noted):
+#
+#   header      magic "BWS3" | format 3 | component count | chunk size | reserved | device id (4) | nonce base (8)
+#   descriptor  per component: id | version | size (4) | chunk count | reserved | Merkle root of page hashes (32)
+#   header tag  GCM tag over AAD = device AAD + header + descriptors, nonce = nonce base + 0xFFFFFFFF
+#   section     per component: id, then chunk i = GCM(data[i*1024:(i+1)*1024]) | tag,
+#               AAD = device AAD + header + descriptors, nonce = nonce base + (id << 16 | i) (big-endian)
+#
+# Components: 0 firmware, 1 release message (+ NUL), 2 config. The updater may
+# leave out sections for components the device already has.
@@ -15,7 +15,13 @@ A frame consists of two sections:
 | Length | Data... |
 --------------------
 
-In our case, the data is from one line of the Intel Hex formated .hex file
+In our case, the data is the next slice of a v3 package (see fw_protect.py).
+The package header, its component descriptors and their tag are sent first and
+must be acknowledged before any frame; the bootloader then verifies each chunk
+as soon as it is complete and answers the frame that finished a bad chunk with
+an error. Sections for components the device already has (same version, size
+and digest) are left out, so e.g. a new release message does not re-send the
+firmware.
 
 We write a frame to the bootloader, then wait for it to respond with an
 OK message so we can write the next frame. The OK message in this case is
@@ -26,6 +32,8 @@ import argparse
 import struct
 import time
 import socket
+import threading
+import zlib
 
 from util import *
 
@@ -35,53 +43,65 @@ from Crypto.Hash import SHA256
 
 RESP_OK = b"\x00"
 FRAME_SIZE = 256
-
-
-def send_metadata(ser, metadata, debug=False):
-    version, size = struct.unpack_from("<HH", metadata)
-    #version and size will already be in little endian 
-    print(f"Version: {version}\nSize: {size} bytes\n")
-    version = bytes(version)
-    size = bytes(size)
-    # Handshake for update
-    ser.write(b"U")
-
-    print("Waiting for bootloader to enter update mode...")
-    while ser.read(1).decode() != "U":
-        print("got a byte")
-        pass
-    # Send size and version to bootloader.
+HEADER_FMT = "<4sHHHHI8s" # v3 package header, see fw_protect.py
+DESC_FMT = "<HHIHH32s"    # component descriptor
+ENTRY_FMT = "<HHII32s"    # installed component as reported by the bootloader
+COMP_COUNT = 3            # component ids the bootloader knows
+HEADER_SIZE = struct.calcsize(HEADER_FMT)
+DESC_SIZE = struct.calcsize(DESC_FMT)
+ENTRY_SIZE = struct.calcsize(ENTRY_FMT)
+TAG_SIZE = 16
+STATS_FMT = "<IIII7III256HI" # update_stats_t, see bootloader.h
+STATS_SIZE = struct.calcsize(STATS_FMT)
+FAIL_CAUSES = ["format", "device", "downgrade", "auth", "frame", "sequence", "digest"]
+FLASH_PAGESIZE = 1024
+INFO_FMT = "<4sHHHHIII"   # device_info_t, answer to the 'Q' device query
+INFO_SIZE = struct.calcsize(INFO_FMT)
+QUERY_TIMEOUT = 2.0       # seconds; bootloaders without 'Q' never answer it
+FEATURES = {0: "partial", 1: "stats", 2: "trace", 3: "crc32", 4: "stripe"}
+
+# Frame start markers; each selects the frame's integrity trailer
+FRAME_SHA256 = 1          # SHA-256 of the decimal byte sum, 32 bytes
+FRAME_CRC32 = 2           # CRC-32 (zlib) of the frame, 4 bytes little-endian
+FRAME_STRIPED = 3         # little-endian sequence number, then CRC-32 over it, the length and the frame
+TRAILER_SIZE = {"sha256": 32, "crc32": 4}
+
+# What update() assumes of a bootloader it cannot query: one that entered
+# update mode at the firmware's request already waits for the header, and
+# takes CRC-32 frames
+ENTERED_DEVICE = {"format": 3, "max_frame": FRAME_SIZE, "features": {"crc32"}, "device_id": None,
+                  "free_flash": None, "installed": {}, "capacity": {}}
+
+
+def frame_parts(data, integrity="sha256", seq=None):
+    # Start marker + length, and trailer, to send around data; seq makes a striped frame
+    length = len(data)
+    if seq is not None:
+        # The end frame has a trailer too, so a corrupted length cannot end
+        # the transfer early
+        fields = struct.pack("<H", seq & 0xFFFF) + struct.pack(">H", length)
+        header = p16(FRAME_STRIPED, endian = "little") + fields
+        hashed_checksum = struct.pack("<I", zlib.crc32(data, zlib.crc32(fields)))
+    elif integrity == "crc32":
+        header = p16(FRAME_CRC32, endian = "little") + struct.pack(">H", length)
+        hashed_checksum = struct.pack("<I", zlib.crc32(data))
+    else:
+        header = p16(FRAME_SHA256, endian = "little") + struct.pack(">H", length)
+        checksum = sum(data)
+        hash = SHA256.new()
+        hash.update(bytes(str(checksum),encoding = 'utf8'))
+        hashed_checksum = hash.digest()
+    return header, hashed_checksum
+
+
+def send_frame(ser, data, debug=False, integrity="sha256"):
+    # data is a memoryview slice of the image; it is never copied into a new frame
+    header, hashed_checksum = frame_parts(data, integrity)
     if debug:
-        print(metadata)
+        print(len(data), len(hashed_checksum))
 
-    ser.write(version)
-    ser.write(size)
-
-    # Wait for an OK from the bootloader.
-    resp = ser.read(1)
-    if resp != RESP_OK:
-        raise RuntimeError("ERROR: Bootloader responded with {}".format(repr(resp)))
-
-
-def send_frame(ser, frame, debug=False):
-    ser.write(p16(1,endian = "little"))
-    checksum = 0
-    ser.write(frame)  # Write the frame...
-    frame = frame[2:]
-    if debug:
-        print(len(frame))
-    
-    for i in range (len(frame)):
-        checksum+=frame[i]
-    hash = SHA256.new()
-    hash.update(bytes(str(checksum),encoding = 'utf8'))
-    hashed_checksum = hash.digest()
-    ser.write(hashed_checksum)
-    if debug:
-        print(len(hashed_checksum))
-    resp = ser.read(1)  # Wait for an OK from the bootloader
-
-    time.sleep(0.1)
+    ser.write(header, data, hashed_checksum)  # start marker + length, data, checksum in one vectored send
+    resp = ser.read_exact(1)  # Wait for an OK from the bootloader
 
     if resp != RESP_OK:
         raise RuntimeError("ERROR: Bootloader responded with {}".format(repr(resp)))
@@ -90,128 +110,288 @@ def send_frame(ser, frame, debug=False):
         print("Resp: {}".format(ord(resp)))
 
 
-def update(ser, infile, debug):
+def send_striped(links, frames, debug=False):
+    """
+    Send frames over several links at once: frame i goes out on link
+    i % len(links) with sequence number i, and each link has one frame in
+    flight. The bootloader parses them in sequence order and acknowledges
+    each on the first link, so the acks come back in order and each one
+    frees the link of the frame it answers.
+    """
+    acked = 0
+    for seq, data in enumerate(frames):
+        if seq >= len(links):
+            wait_ack(links[0], acked)
+            acked += 1
+        header, trailer = frame_parts(data, seq=seq)
+        links[seq % len(links)].write(header, data, trailer)
+        if debug:
+            print(f"Frame {seq} ({len(data)} bytes) on link {seq % len(links)}")
+    while acked < len(frames):
+        wait_ack(links[0], acked)
+        acked += 1
+
+
+def wait_ack(ser, seq):
+    resp = ser.read_exact(1)
+    if resp != RESP_OK:
+        raise RuntimeError("ERROR: Bootloader responded to frame {} with {}".format(seq, repr(resp)))
+
+
+def drain(ser):
+    # Discard what the device prints on a link the host is sending frames on
+    def run():
+        try:
+            while True:
+                ser.read(RECV_CHUNK)
+        except (OSError, EOFError):
+            pass
+    thread = threading.Thread(target=run, daemon=True)
+    thread.start()
+    return thread
+
+
+def query_components(ser):
+    # Ask the bootloader what is installed: {id: (version, size, digest)}
+    ser.write(b"C")
+    if ser.read_exact(1) != b"C":
+        raise RuntimeError("ERROR: Bootloader did not answer the component query")
+    table = ser.read_exact(COMP_COUNT * ENTRY_SIZE)
+    installed = {}
+    for i in range(COMP_COUNT):
+        comp_id, version, size, _, digest = struct.unpack_from(ENTRY_FMT, table, i * ENTRY_SIZE)
+        if size:
+            installed[comp_id] = (version, size, digest)
+    return installed
+
+
+def query_device(ser):
+    """
+    Ask the bootloader what it runs and accepts ('Q'): package format, largest
+    frame, feature flags, device id, free flash, and each component's
+    installed (version, size, digest) and capacity. A bootloader that predates
+    'Q' ignores it; then only the component table ('C') is used and the rest
+    is assumed from this tool's defaults.
+    """
+    previous = ser.ser_socket.gettimeout()
+    ser.set_timeout(QUERY_TIMEOUT)
+    try:
+        ser.write(b"Q")
+        reply = ser.read_exact(1)
+    except socket.timeout:
+        reply = None
+    finally:
+        ser.set_timeout(previous)
+
+    if reply is None:
+        return {"format": 3, "max_frame": FRAME_SIZE, "features": set(), "device_id": None,
+                "free_flash": None, "installed": query_components(ser), "capacity": {}}
+    if reply != b"Q":
+        raise RuntimeError("ERROR: Bootloader did not answer the device query")
+
+    magic, fmt, max_frame, chunk_size, comp_count, features, device_id, free_flash = struct.unpack(INFO_FMT, ser.read_exact(INFO_SIZE))
+    if magic != b"DEV1":
+        raise RuntimeError("ERROR: Bootloader sent a malformed device query answer")
+    table = ser.read_exact(comp_count * ENTRY_SIZE)
+    capacities = struct.unpack(f"<{comp_count}I", ser.read_exact(4 * comp_count))
+    installed = {}
+    capacity = {}
+    for i in range(comp_count):
+        comp_id, version, size, _, digest = struct.unpack_from(ENTRY_FMT, table, i * ENTRY_SIZE)
+        capacity[comp_id] = capacities[i]
+        if size:
+            installed[comp_id] = (version, size, digest)
+    return {"format": fmt, "max_frame": max_frame, "chunk_size": chunk_size,
+            "features": {name for bit, name in FEATURES.items() if features & (1 << bit)},
+            "device_id": device_id, "free_flash": free_flash, "installed": installed, "capacity": capacity}
+
+
+def print_device(device):
+    print(f"Package format: {device['format']}  Max frame: {device['max_frame']} bytes")
+    print(f"Features: {', '.join(sorted(device['features'])) or 'none'}")
+    if device["device_id"] is not None:
+        print(f"Device id: 0x{device['device_id']:08x}  Free flash: {device['free_flash']} bytes")
+    for comp_id, (version, size, digest) in sorted(device["installed"].items()):
+        print(f"Component {comp_id}: version {version}, {size} bytes, digest {digest.hex()}")
+
+
+def split_package(package):
+    # Split a v3 package into its authenticated header and one section per component
+    _, _, comp_count, _, _, _, _ = struct.unpack_from(HEADER_FMT, package)
+    header_len = HEADER_SIZE + comp_count * DESC_SIZE + TAG_SIZE
+    sections = []
+    offset = header_len
+    for i in range(comp_count):
+        comp_id, version, size, chunk_count, _, digest = struct.unpack_from(DESC_FMT, package, HEADER_SIZE + i * DESC_SIZE)
+        length = 2 + size + chunk_count * TAG_SIZE  # id, then each chunk's ciphertext + tag
+        sections.append((comp_id, (version, size, digest), package[offset:offset + length]))
+        offset += length
+    return package[:header_len], sections
+
+
+def update(ser, infile, debug, force=False, integrity="auto", stripe_ser=None, entered=False):
+    # stripe_ser: the device's UART2, to stripe frames over both links when it can
+    # entered: the bootloader is already in update mode (see request_update)
     # Open serial port. Set baudrate to 115200. Set timeout to 2 seconds.
     with open(infile, "rb") as fp:
-        all_data = fp.read()
-    size = all_data[:2]
-    data_to_send = all_data[2:-16-16] # -16 for tag, -12 for nonce
-    tag = all_data[-16:]
-    gcm_nonce = all_data[-16-16:-16]
-    ser.write(b"U")
-
-    print("Waiting for bootloader to enter update mode...")
-    while ser.read(1).decode() != "U":
-        print("got a byte")
-        pass
-    print("Writing Size")
-    ser.write(size)
-    print("Writing nonce+tag")
-    ser.write(gcm_nonce)
-    ser.write(tag)
+        all_data = memoryview(fp.read())
+    header, sections = split_package(all_data)  # v3 header + descriptors + tag, then sections
+
+    # Only send components that differ from what is installed, and refuse a
+    # package the bootloader would reject here rather than after 'U'
+    device = ENTERED_DEVICE if entered else query_device(ser)
+    _, fmt, _, _, _, device_id, _ = struct.unpack_from(HEADER_FMT, header)
+    if fmt != device["format"]:
+        raise RuntimeError(f"ERROR: package format {fmt} is not the device's format {device['format']}")
+    if device["device_id"] is not None and device_id != device["device_id"]:
+        raise RuntimeError(f"ERROR: package is for device 0x{device_id:08x}, not 0x{device['device_id']:08x}")
+    installed = {} if force else device["installed"]
+    for comp_id, (version, size, _), _ in sections:
+        if comp_id in installed and version != 0 and version < installed[comp_id][0]:
+            raise RuntimeError(f"ERROR: component {comp_id} version {version} is older than installed version {installed[comp_id][0]}")
+        if size > device["capacity"].get(comp_id, size):
+            raise RuntimeError(f"ERROR: component {comp_id} ({size} bytes) does not fit in {device['capacity'][comp_id]} bytes")
+    to_send = [section for comp_id, desc, section in sections if installed.get(comp_id) != desc]
+    print(f"Sending {len(to_send)} of {len(sections)} components")
+    if not to_send:
+        print("Device already has every component in this package.")
+        return ser
+    data_to_send = memoryview(b"".join(to_send))
+    frame_size = min(FRAME_SIZE, device["max_frame"])
+    frames = [data_to_send[i : i + frame_size] for i in range(0, len(data_to_send), frame_size)]
+
+    # Striping needs the device's support and a second link; otherwise the
+    # update runs over UART1 alone
+    striped = stripe_ser is not None and "stripe" in device["features"]
+    if stripe_ser is not None and not striped:
+        print("Device does not take striped updates, using UART1 only")
+    if not entered:
+        command = b"W" if striped else b"U"
+        ser.write(command)
+
+        print("Waiting for bootloader to enter update mode...")
+        while ser.read_exact(1) != command:
+            print("got a byte")
+            pass
+    print("Writing header")
+    ser.write(header)
+    resp = ser.read_exact(1)  # The bootloader vets the header before any chunk
+    if resp != RESP_OK:
+        raise RuntimeError("ERROR: Bootloader rejected the package header with {}".format(repr(resp)))
+
     print("Writing firmware.")
     print(len(data_to_send))
-    for idx, frame_start in enumerate(range(0, len(data_to_send), FRAME_SIZE)):
-        data = data_to_send[frame_start : frame_start + FRAME_SIZE]
-
-        # Get length of data.
-        length = len(data)
-        frame_fmt = ">H{}s".format(length)
-
-        # Construct frame.
-        frame = struct.pack(frame_fmt, length, data)
-        send_frame(ser, frame, debug=debug)
-        print(f"Wrote frame {idx} ({len(frame)} bytes)")
-
-    print("Done writing firmware.")
+    start = time.monotonic()
+    if striped:
+        # The zero length frame goes in the same stream; its ack comes once
+        # every chunk is in flash
+        drain(stripe_ser)
+        send_striped([ser, stripe_ser], frames + [b""], debug=debug)
+        elapsed = time.monotonic() - start
+        overhead = len(frames) * (6 + TRAILER_SIZE["crc32"])
+        print(f"Striped over 2 links: {len(frames)} frames, {overhead} bytes of framing, {elapsed:.3f} s "
+              f"({len(data_to_send) / elapsed / 1000:.1f} kB/s)")
+        print("Done writing firmware.")
+        return ser
+
+    # Largest frame both sides handle: fewer frames, fewer round trips. The
+    # GCM tags authenticate the data, so a CRC trailer is enough when the
+    # device takes it.
+    if integrity == "auto":
+        integrity = "crc32" if "crc32" in device["features"] else "sha256"
+    elif integrity == "crc32" and "crc32" not in device["features"]:
+        raise RuntimeError("ERROR: device does not accept CRC-32 frames")
+    for idx, data in enumerate(frames):
+        send_frame(ser, data, debug=debug, integrity=integrity)
+        print(f"Wrote frame {idx} ({len(data) + 2} bytes)")
 
     # Send a zero length payload to tell the bootlader to finish writing it's page.
-    ser.write(p16(1,endian = "little"))
-    ser.write(struct.pack(">H", 0x0000))
-    resp = ser.read(1)  # Wait for an OK from the bootloader
+    ser.write(p16(FRAME_CRC32 if integrity == "crc32" else FRAME_SHA256, endian = "little"), struct.pack(">H", 0x0000))
+    resp = ser.read_exact(1)  # Wait for an OK from the bootloader
     if resp != RESP_OK:
         raise RuntimeError("ERROR: Bootloader responded to zero length frame with {}".format(repr(resp)))
-    print(f"Wrote zero length frame (2 bytes)")
-
-    return ser
-
-
+    elapsed = time.monotonic() - start
 
+    overhead = len(frames) * (4 + TRAILER_SIZE[integrity])
+    print(f"Integrity: {integrity}, {len(frames)} frames, {overhead} bytes of framing "
+          f"({100.0 * overhead / (len(data_to_send) + overhead):.1f}% of the wire), {elapsed:.3f} s "
+          f"({len(data_to_send) / elapsed / 1000:.1f} kB/s)")
+    print("Done writing firmware.")
 
-def send_metadata_default(ser, metadata, debug=False):
-    version, size = struct.unpack_from("<HH", metadata)
-    print(f"Version: {version}\nSize: {size} bytes\n")
+    return ser
 
-    # Handshake for update
-    ser.write(b"U")
 
-    print("Waiting for bootloader to enter update mode...")
-    while ser.read(1).decode() != "U":
-        print("got a byte")
+def request_update(ser, console):
+    """
+    Ask the running firmware to reset into update mode (its REFLASH command
+    on UART2) instead of racing the bootloader's prompt after a reset. The
+    bootloader skips its banner and announces the update with "U" on UART1;
+    follow with update(..., entered=True). It starts the firmware again when
+    the update ends, and the firmware prints the result.
+    """
+    drain(console)
+    console.write(b"REFLASH\n")
+    print("Waiting for the firmware to reset into update mode...")
+    while ser.read_exact(1) != b"U":
         pass
 
-    # Send size and version to bootloader.
-    if debug:
-        print(metadata)
-
-    ser.write(metadata)
-
-    # Wait for an OK from the bootloader.
-    resp = ser.read(1)
-    if resp != RESP_OK:
-        raise RuntimeError("ERROR: Bootloader responded with {}".format(repr(resp)))
 
+def mem_report(ser):
+    # Ask the bootloader for its peak stack and arena use since reset
+    ser.write(b"M")
+    if ser.read_exact(1) != b"M":
+        raise RuntimeError("ERROR: Bootloader did not answer the memory report request")
+    stack_used, stack_size, arena_used, arena_size = struct.unpack("<IIII", ser.read_exact(16))
+    print(f"Stack high water: {stack_used} / {stack_size} bytes")
+    print(f"Arena high water: {arena_used} / {arena_size} bytes")
+    return stack_used, stack_size, arena_used, arena_size
+
+
+def query_stats(ser):
+    # Ask the bootloader for its persistent update statistics and print them
+    ser.write(b"S")
+    if ser.read_exact(1) != b"S":
+        raise RuntimeError("ERROR: Bootloader did not answer the statistics query")
+    fields = struct.unpack(STATS_FMT, ser.read_exact(STATS_SIZE))
+    attempts, successes = fields[2:4]
+    failures = dict(zip(FAIL_CAUSES, fields[4:11]))
+    bytes_received, last_ms = fields[11:13]
+    erase_counts = fields[13:13 + 256]
+
+    print(f"Updates: {attempts} attempted, {successes} succeeded")
+    print("Failures: " + ", ".join(f"{cause} {count}" for cause, count in failures.items()))
+    print(f"Bytes received: {bytes_received}")
+    print(f"Last update: {last_ms} ms")
+    print("Erases per page:")
+    for page, count in enumerate(erase_counts):
+        if count:
+            print(f"  0x{page * FLASH_PAGESIZE:05x}: {count}")
+    return {"attempts": attempts, "successes": successes, "failures": failures,
+            "bytes_received": bytes_received, "last_duration_ms": last_ms, "erase_counts": erase_counts}
+
+
+def connect(sock_dir=SOCK_DIR, timeout=None, keep_uart2=False):
+    """
+    Connect to the UARTs of the device whose sockets live in sock_dir.
+    Returns the UART1 serial wrapper; UART0 and UART2 are closed. With
+    keep_uart2, returns (UART1, UART2) instead, for a striped update.
+    """
+    uart0_path, uart1_path, uart2_path = uart_paths(sock_dir)
+
+    # QEMU opens each socket only after the previous one is connected, so
+    # connect_socket() retries each until it is ready instead of sleeping
+    uart0_sock = connect_socket(uart0_path)
+    uart1_sock = connect_socket(uart1_path)
+    uart1 = DomainSocketSerial(uart1_sock, timeout=timeout)
+    uart2_sock = connect_socket(uart2_path)
 
-def send_frame_default(ser, frame, debug=False):
-    ser.write(frame)  # Write the frame...
-
-    if debug:
-        print_hex(frame)
-
-    resp = ser.read(1)  # Wait for an OK from the bootloader
-
-    time.sleep(0.1)
-
-    if resp != RESP_OK:
-        raise RuntimeError("ERROR: Bootloader responded with {}".format(repr(resp)))
-
-    if debug:
-        print("Resp: {}".format(ord(resp)))
-
-
-def update_default(ser, infile, debug):
-    # Open serial port. Set baudrate to 115200. Set timeout to 2 seconds.
-    with open(infile, "rb") as fp:
-        firmware_blob = fp.read()
-
-    metadata = firmware_blob[:4]
-    firmware = firmware_blob[4:]
-
-    send_metadata(ser, metadata, debug=debug)
-
-    for idx, frame_start in enumerate(range(0, len(firmware), FRAME_SIZE)):
-        data = firmware[frame_start : frame_start + FRAME_SIZE ]
-
-        # Get length of data.
-        length = len(data)
-        frame_fmt = ">H{}s".format(length)
-
-        # Construct frame.
-        frame = struct.pack(frame_fmt, length, data)
-
-        send_frame(ser, frame, debug=debug)
-        print(f"Wrote frame {idx} ({len(frame)} bytes)")
-
-    print("Done writing firmware.")
-
-    # Send a zero length payload to tell the bootlader to finish writing it's page.
-    ser.write(struct.pack(">H", 0x0000))
-    resp = ser.read(1)  # Wait for an OK from the bootloader
-    if resp != RESP_OK:
-        raise RuntimeError("ERROR: Bootloader responded to zero length frame with {}".format(repr(resp)))
-    print(f"Wrote zero length frame (2 bytes)")
+    # Close unused UARTs (if we leave these open it will hang)
+    uart0_sock.close()
+    if keep_uart2:
+        return uart1, DomainSocketSerial(uart2_sock, timeout=timeout)
+    uart2_sock.close()
 
-    return ser
+    return uart1
 
 
 if __name__ == "__main__":
@@ -219,38 +399,63 @@ if __name__ == "__main__":
 
     parser.add_argument("--port", help="Does nothing, included to adhere to command examples in rule doc", required=False)
     parser.add_argument("--firmware", help="Path to firmware image to load.", required=False)
+    parser.add_argument("--sock-dir", help="Directory holding the device's UART0-2 sockets.", default=SOCK_DIR)
+    parser.add_argument("--timeout", help="Seconds to wait for each bootloader response.", type=float, default=None)
+    parser.add_argument("--force", help="Send every component, even ones the device already has.", action="store_true")
+    parser.add_argument("--integrity", help="Frame trailer: crc32 (4 bytes), sha256 (32 bytes, the original format), or auto (crc32 when the device supports it).", choices=["auto", "crc32", "sha256"], default="auto")
+    parser.add_argument("--reflash", help="Ask the running firmware to reset into update mode first (sends every component).", action="store_true")
+    parser.add_argument("--stripe", help="Send frames over UART1 and UART2 at once when the device supports it.", action="store_true")
+    parser.add_argument("--mem-report", help="Print the bootloader's stack and arena high-water marks (after the update, if any).", action="store_true")
+    parser.add_argument("--info", help="Print what the device has installed and which protocol options it supports.", action="store_true")
+    parser.add_argument("--stats", help="Print the bootloader's update statistics and flash erase counts (after the update, if any).", action="store_true")
     parser.add_argument("--debug", help="Enable debugging messages.", action="store_true")
     args = parser.parse_args()
 
-    uart0_sock = socket.socket(socket.AF_UNIX, socket.SOCK_STREAM)
-    uart0_sock.connect(UART0_PATH)
-
-    time.sleep(0.2)  # QEMU takes a moment to open the next socket
-
-    uart1_sock = socket.socket(socket.AF_UNIX, socket.SOCK_STREAM)
-    uart1_sock.connect(UART1_PATH)
-    uart1 = DomainSocketSerial(uart1_sock)
-
-    time.sleep(0.2)
-
-    uart2_sock = socket.socket(socket.AF_UNIX, socket.SOCK_STREAM)
-    uart2_sock.connect(UART2_PATH)
-
-    # Close unused UARTs (if we leave these open it will hang)
-    uart2_sock.close()
-    uart0_sock.close()
-
-    update(ser=uart1, infile=args.firmware, debug=args.debug)
-
-    uart1_sock.close()
-
-
+    uart2 = None
+    if args.stripe or args.reflash:
+        uart1, uart2 = connect(args.sock_dir, timeout=args.timeout, keep_uart2=True)
+    else:
+        uart1 = connect(args.sock_dir, timeout=args.timeout)
+
+    if args.info:
+        print_device(query_device(uart1))
+    if args.firmware:
+        if args.reflash:
+            request_update(uart1, uart2)
+        update(ser=uart1, infile=args.firmware, debug=args.debug, force=args.force, integrity=args.integrity,
+               stripe_ser=uart2 if args.stripe else None, entered=args.reflash)
+    if args.mem_report:
+        mem_report(uart1)
+    if args.stats:
+        query_stats(uart1)
+
+    uart1.close()
+    if uart2 is not None:
+        uart2.close()
+
+
+#S
+#<-                       #S + update statistics record
+#T
+#<-                       #T (trace ring dumped on UART2, see bl_trace.py)
+#Q
+#<-                       #Q + device info + component table + capacities
+#C
+#<-                       #C + component table
+#W (striped update, if the device lists "stripe")
+#<-                       #W, then as U below except for the frames:
+    #3 + SEQ (LE u16) + LEN + DATA + CRC-32 over SEQ and DATA, frame i on UART(1 + i % 2)
+    #<-                       #OK on UART1, in sequence order, one frame in flight per link
 #U
 #<-                       #U
+#(or REFLASH on the firmware's UART2 console: the bootloader resets into update mode)
+#<-                       #U, unsolicited
 #                         #load_firmware()
-#SIZE
+#HEADER+DESCRIPTORS+TAG
+#<-                       #OK (header authenticated)
 #LOOP
-    #1
-    #DATA256   
+    #1 (SHA-256 trailer) or 2 (CRC-32 trailer)
+    #DATA256 (component id + chunks, for each component sent)
+    #TRAILER
     #<-                       #OK
 #0 length frame
\ No newline at end of file
@@ -0,0 +1,376 @@
+#!/usr/bin/env python
+
+# Copyright 2023 The MITRE Corporation. ALL RIGHTS RESERVED
+# Approved for public release. Distribution unlimited 23-02181-13.
+
+"""
+Serial Link Simulator
+
+QEMU's UART sockets never lose or delay a byte. This proxy sits between the
+update tool and a device's UART1 socket and makes the link behave like a real
+cable: a baud-rate cap, fixed per-byte latency, jitter, dropped bytes, single
+bit flips and burst errors, all drawn from a seeded RNG so a run can be
+repeated exactly. UART0 and UART2 are passed through untouched.
+
+Proxy an already running device, then point the update tool at the proxy:
+python3 link_sim.py --sock-dir /embsec --proxy-dir /tmp/lossy --baud 9600 --drop 1e-4
+python3 fw_update.py --sock-dir /tmp/lossy --firmware protected_firmware.bin
+
+Or sweep impairments over fresh emulated devices and report goodput and how
+long the device takes to answer again after a failed update:
+python3 link_sim.py --sweep --firmware protected_firmware.bin --vary drop=0,1e-4,1e-3 --vary baud=0,115200 --trials 3
+"""
+
+import argparse
+import collections
+import itertools
+import math
+import os
+import pathlib
+import random
+import select
+import shutil
+import socket
+import tempfile
+import threading
+import time
+
+from util import *
+
+BITS_PER_BYTE = 10      # 8N1: start bit, 8 data bits, stop bit
+POLL_INTERVAL = 0.05    # seconds a pump waits for data when nothing is queued
+RESPONSE_TIMEOUT = 10.0 # seconds before a silent device fails the update
+RECOVERY_TIMEOUT = 30.0 # seconds to keep polling a device after a failure
+RECOVERY_POLL = 0.25    # seconds between 'Q' polls while it recovers
+
+# Impairment parameters: name -> (type, default, meaning)
+PARAMS = {
+    "baud": (int, 0, "line rate in bits/s, 10 bits per byte (0: unlimited)"),
+    "latency": (float, 0.0, "ms every byte is delayed"),
+    "jitter": (float, 0.0, "up to this many ms of extra random delay per byte"),
+    "drop": (float, 0.0, "probability that a byte is lost"),
+    "ber": (float, 0.0, "probability that any one bit is flipped"),
+    "burst": (float, 0.0, "probability that a burst error starts at a byte"),
+    "burst_len": (int, 8, "bytes replaced with noise by each burst"),
+}
+
+
+def default_profile():
+    return {name: default for name, (_, default, _) in PARAMS.items()}
+
+
+class Impairer:
+    """
+    One direction of the link. feed() takes the bytes as sent and returns
+    (due time, byte) pairs for the bytes that survive, in order: a serial line
+    delays and corrupts bytes but never reorders them.
+    """
+
+    def __init__(self, profile, rng):
+        self.profile = profile
+        self.rng = rng
+        self.wire_free = 0.0   # when the last byte finishes on the wire
+        self.last_due = 0.0
+        self.burst_left = 0
+        self.bits_to_flip = self._next_flip()
+        self.counts = collections.Counter()
+
+    def _next_flip(self):
+        # Bits until the next flip, geometric in the bit error rate
+        ber = self.profile["ber"]
+        if ber <= 0:
+            return math.inf
+        if ber >= 1:
+            return 0
+        return int(math.log(1.0 - self.rng.random()) / math.log(1.0 - ber))
+
+    def feed(self, data, now):
+        p = self.profile
+        byte_time = BITS_PER_BYTE / p["baud"] if p["baud"] else 0.0
+        out = []
+        for byte in data:
+            self.counts["bytes"] += 1
+            if self.burst_left:
+                byte = self.rng.randrange(256)
+                self.burst_left -= 1
+                self.counts["burst_bytes"] += 1
+            elif p["burst"] and self.rng.random() < p["burst"]:
+                byte = self.rng.randrange(256)
+                self.burst_left = p["burst_len"] - 1
+                self.counts["bursts"] += 1
+                self.counts["burst_bytes"] += 1
+
+            while self.bits_to_flip < 8:
+                byte ^= 1 << self.bits_to_flip
+                self.counts["bit_flips"] += 1
+                self.bits_to_flip += 1 + self._next_flip()
+            self.bits_to_flip -= 8
+
+            # The byte occupies the wire whether or not it arrives
+            self.wire_free = max(now, self.wire_free) + byte_time
+            if p["drop"] and self.rng.random() < p["drop"]:
+                self.counts["dropped"] += 1
+                continue
+            due = self.wire_free + (p["latency"] + self.rng.uniform(0.0, p["jitter"])) / 1000.0
+            self.last_due = max(due, self.last_due)
+            out.append((self.last_due, byte))
+        return out
+
+
+class LinkSim:
+    """
+    Listens on listen_path and, for every client, connects to upstream_path
+    and relays both ways through an Impairer per direction. Each session draws
+    its two RNG seeds from one seeded generator, so the whole run repeats.
+    """
+
+    def __init__(self, upstream_path, listen_path, profile, seed=0):
+        self.upstream_path = upstream_path
+        self.listen_path = listen_path
+        self.profile = profile
+        self.seeds = random.Random(seed)
+        self.counts = {"up": collections.Counter(), "down": collections.Counter()}
+        self.closed = False
+        self.pumps = []
+
+        if os.path.exists(listen_path):
+            os.remove(listen_path)
+        self.server = socket.socket(socket.AF_UNIX, socket.SOCK_STREAM)
+        self.server.bind(listen_path)
+        self.server.listen(1)
+        self.thread = threading.Thread(target=self._serve, daemon=True)
+        self.thread.start()
+
+    def _serve(self):
+        while not self.closed:
+            try:
+                client, _ = self.server.accept()
+            except OSError:
+                return
+            upstream = connect_socket(self.upstream_path)
+            up = Impairer(self.profile, random.Random(self.seeds.getrandbits(32)))
+            down = Impairer(self.profile, random.Random(self.seeds.getrandbits(32)))
+            for args in ((client, upstream, up, "up"), (upstream, client, down, "down")):
+                pump = threading.Thread(target=self._pump, args=args, daemon=True)
+                pump.start()
+                self.pumps.append(pump)
+
+    def _pump(self, src, dst, impairer, direction):
+        # After src closes, what is still on the wire is delivered before dst is closed
+        pending = collections.deque()
+        eof = False
+        try:
+            while not self.closed and not (eof and not pending):
+                timeout = max(0.0, pending[0][0] - time.monotonic()) if pending else POLL_INTERVAL
+                if eof:
+                    time.sleep(timeout)
+                elif select.select([src], [], [], timeout)[0]:
+                    chunk = src.recv(RECV_CHUNK)
+                    eof = not chunk
+                    pending.extend(impairer.feed(chunk, time.monotonic()))
+
+                now = time.monotonic()
+                out = bytearray()
+                while pending and pending[0][0] <= now:
+                    out.append(pending.popleft()[1])
+                if out:
+                    dst.sendall(out)
+        except OSError:
+            pass
+        finally:
+            self.counts[direction].update(impairer.counts)
+            for sock in (src, dst):
+                try:
+                    sock.shutdown(socket.SHUT_RDWR)
+                except OSError:
+                    pass
+                sock.close()
+
+    def close(self):
+        # Pumps stop within POLL_INTERVAL and add their counts on the way out
+        self.closed = True
+        self.server.close()
+        for pump in self.pumps:
+            pump.join()
+        if os.path.exists(self.listen_path):
+            os.remove(self.listen_path)
+
+
+def make_proxy_dir(sock_dir, proxy_dir, profile, seed=0):
+    """
+    Lay out proxy_dir like a device socket directory: UART0 and UART2 link to
+    the device's sockets, UART1 is the simulated link. Returns the LinkSim.
+    """
+    real = uart_paths(sock_dir)
+    proxied = uart_paths(proxy_dir)
+    os.makedirs(proxy_dir, exist_ok=True)
+    for i in (0, 2):
+        if os.path.lexists(proxied[i]):
+            os.remove(proxied[i])
+        os.symlink(os.path.abspath(real[i]), proxied[i])
+    return LinkSim(real[1], proxied[1], profile, seed)
+
+
+def wait_recovered(ser, timeout=RECOVERY_TIMEOUT):
+    """
+    After a failed update, poll with 'Q' over the same link until a device
+    info answer comes back. Stray poll bytes may first be taken as frame data;
+    that is part of what recovery costs. Returns the seconds taken, or None.
+    """
+    start = time.monotonic()
+    ser.set_timeout(RECOVERY_POLL)
+    seen = bytearray()
+    while time.monotonic() - start < timeout:
+        ser.write(b"Q")
+        try:
+            while True:
+                seen += ser.read(RECV_CHUNK)
+                if b"QDEV1" in seen:
+                    return time.monotonic() - start
+        except socket.timeout:
+            pass
+        except EOFError:
+            return None
+        del seen[:-4]
+    return None
+
+
+def run_trial(binary_path, work_dir, firmware_path, profile, seed, timeout=RESPONSE_TIMEOUT):
+    # Update a fresh device through the simulated link and return the result record
+    from bl_emulate import emulate
+    from fw_update import connect, update
+
+    sock_dir = os.path.join(work_dir, "dev")
+    proxy_dir = os.path.join(work_dir, "link")
+    result = {"ok": False, "seconds": 0.0, "recovery": None, "error": None, "counts": None}
+
+    proc = emulate(binary_path, sock_dir=sock_dir, flash_dir=os.path.join(work_dir, "dev.flash"))
+    link = make_proxy_dir(sock_dir, proxy_dir, profile, seed)
+    try:
+        ser = connect(proxy_dir, timeout=timeout)
+        start = time.monotonic()
+        try:
+            update(ser=ser, infile=firmware_path, debug=False, force=True)
+            result["ok"] = True
+        except (RuntimeError, ValueError, socket.timeout, EOFError, OSError) as e:
+            result["error"] = str(e) or type(e).__name__
+        result["seconds"] = time.monotonic() - start
+        if not result["ok"]:
+            result["recovery"] = wait_recovered(ser)
+        ser.close()
+    finally:
+        link.close()
+        proc.kill()
+        proc.wait()
+    result["counts"] = link.counts
+    return result
+
+
+def sweep(binary_path, firmware_path, base, vary, trials, seed=0, timeout=RESPONSE_TIMEOUT, csv_path=None):
+    """
+    Run trials updates for every combination of the varied parameters, on top
+    of the base profile. Goodput is package bytes over update time, counting
+    successful updates only.
+    """
+    from bl_emulate import check_private_flash
+
+    check_private_flash()  # before any trial, so devices never share /flash
+    size = os.path.getsize(firmware_path)
+    names = list(vary)
+    rows = []
+
+    print("  ".join(f"{n:>9}" for n in names) + "   ok   goodput B/s   update s   recovery s   dropped   flips   bursts")
+    for values in itertools.product(*(vary[n] for n in names)):
+        profile = dict(base, **dict(zip(names, values)))
+        results = []
+        for t in range(trials):
+            work_dir = tempfile.mkdtemp(prefix="embsec-link-")
+            try:
+                results.append(run_trial(binary_path, work_dir, firmware_path, profile, seed + t, timeout))
+            finally:
+                shutil.rmtree(work_dir, ignore_errors=True)
+
+        ok = [r for r in results if r["ok"]]
+        recovered = [r["recovery"] for r in results if r["recovery"] is not None]
+        counts = collections.Counter()
+        for r in results:
+            for c in r["counts"].values():
+                counts.update(c)
+        row = {
+            **profile,
+            "trials": trials,
+            "ok": len(ok),
+            "goodput": size * len(ok) / sum(r["seconds"] for r in ok) if ok else 0.0,
+            "update_s": sum(r["seconds"] for r in ok) / len(ok) if ok else None,
+            "recovery_s": sum(recovered) / len(recovered) if recovered else None,
+            "unrecovered": sum(1 for r in results if not r["ok"] and r["recovery"] is None),
+            "dropped": counts["dropped"],
+            "bit_flips": counts["bit_flips"],
+            "bursts": counts["bursts"],
+        }
+        rows.append(row)
+
+        fmt = lambda v: f"{v:.3f}" if v is not None else "-"
+        print("  ".join(f"{v:>9}" for v in values)
+              + f"  {len(ok):>2}/{trials:<2} {row['goodput']:>11.1f}   {fmt(row['update_s']):>8}   {fmt(row['recovery_s']):>10}"
+              + f"   {counts['dropped']:>7}   {counts['bit_flips']:>5}   {counts['bursts']:>6}")
+        for r in results:
+            if r["error"]:
+                print(f"           error: {r['error']}" + ("" if r["recovery"] is not None or r["ok"] else " (no recovery)"))
+
+    if csv_path:
+        import csv
+        with open(csv_path, "w", newline="") as fp:
+            writer = csv.DictWriter(fp, fieldnames=list(rows[0]))
+            writer.writeheader()
+            writer.writerows(rows)
+    return rows
+
+
+def parse_vary(items):
+    # ["drop=0,1e-4", ...] -> {"drop": [0.0, 0.0001], ...}
+    vary = {}
+    for item in items:
+        name, _, values = item.partition("=")
+        if name not in PARAMS or not values:
+            raise ValueError(f"ERROR: --vary expects one of {', '.join(PARAMS)} as name=v1,v2,...")
+        vary[name] = [PARAMS[name][0](v) for v in values.split(",")]
+    return vary
+
+
+if __name__ == "__main__":
+    parser = argparse.ArgumentParser(description="Serial Link Simulator")
+    parser.add_argument("--sock-dir", help="Socket directory of the device to proxy.", default=SOCK_DIR)
+    parser.add_argument("--proxy-dir", help="Socket directory to create for the update tool.", default="/tmp/embsec-link")
+    for name, (kind, default, meaning) in PARAMS.items():
+        parser.add_argument(f"--{name.replace('_', '-')}", dest=name, help=f"{meaning[0].upper()}{meaning[1:]}.", type=kind, default=default)
+    parser.add_argument("--seed", help="RNG seed; the same seed repeats the same impairments.", type=int, default=0)
+    parser.add_argument("--sweep", help="Benchmark fresh emulated devices instead of proxying one.", action="store_true")
+    parser.add_argument("--firmware", help="Protected firmware to send in each --sweep trial.", default=None)
+    parser.add_argument("--boot-path", help="Path to the the bootloader binary.", default=None)
+    parser.add_argument("--vary", help="Swept parameter as name=v1,v2,...; repeat for a grid.", action="append", default=[])
+    parser.add_argument("--trials", help="Updates per sweep point, with seeds seed..seed+trials-1.", type=int, default=3)
+    parser.add_argument("--timeout", help="Seconds to wait for each bootloader response.", type=float, default=RESPONSE_TIMEOUT)
+    parser.add_argument("--csv", help="Also write the sweep results to this CSV file.", default=None)
+    args = parser.parse_args()
+
+    base = {name: getattr(args, name) for name in PARAMS}
+    if args.sweep:
+        if args.firmware is None:
+            parser.error("--sweep needs --firmware")
+        if args.boot_path is None:
+            binary_path = (pathlib.Path(__file__).parent / ".." / "bootloader" / "gcc" / "main.axf").resolve()
+        else:
+            binary_path = pathlib.Path(args.boot_path).resolve()
+        sweep(binary_path, os.path.abspath(args.firmware), base, parse_vary(args.vary), args.trials, args.seed, args.timeout, args.csv)
+    else:
+        link = make_proxy_dir(args.sock_dir, args.proxy_dir, base, args.seed)
+        print(f"Proxying {args.sock_dir} through {args.proxy_dir}; Ctrl-C to stop")
+        try:
+            while True:
+                time.sleep(1)
+        except KeyboardInterrupt:
+            pass
+        link.close()
+        for direction, counts in link.counts.items():
+            print(f"{direction}: {dict(counts)}")
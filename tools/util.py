@@ -3,40 +3,149 @@
 # Copyright 2023 The MITRE Corporation. ALL RIGHTS RESERVED
 # Approved for public release. Distribution unlimited 23-02181-13.
 
+import os
 import socket
+import time
+
+SOCK_DIR = "/embsec"
+UART0_PATH = os.path.join(SOCK_DIR, "UART0")
+UART1_PATH = os.path.join(SOCK_DIR, "UART1")
+UART2_PATH = os.path.join(SOCK_DIR, "UART2")
+
+RECV_CHUNK = 4096         # bytes pulled from the socket per recv()
+CONNECT_TIMEOUT = 10.0    # seconds to keep retrying a socket connect
+CONNECT_RETRY = 0.005     # seconds between connect attempts
+
+
+def uart_paths(sock_dir=SOCK_DIR):
+    # Socket paths for UART0-2 of one emulated device
+    return [os.path.join(sock_dir, f"UART{i}") for i in range(3)]
+
+
+def connect_socket(path, timeout=CONNECT_TIMEOUT):
+    """
+    Connect to a Unix socket as soon as it is ready. QEMU creates and listens
+    on its UART sockets one after another, so instead of sleeping a fixed time
+    we retry until the connect succeeds or the timeout expires.
+    """
+    deadline = time.monotonic() + timeout
+    while True:
+        sock = socket.socket(socket.AF_UNIX, socket.SOCK_STREAM)
+        try:
+            sock.connect(path)
+            return sock
+        except (FileNotFoundError, ConnectionRefusedError):
+            sock.close()
+            if time.monotonic() > deadline:
+                raise TimeoutError(f"ERROR: could not connect to {path}")
+            time.sleep(CONNECT_RETRY)
 
-UART0_PATH = "/embsec/UART0"
-UART1_PATH = "/embsec/UART1"
-UART2_PATH = "/embsec/UART2"
 
 class DomainSocketSerial:
-    def __init__(self, ser_socket: socket.socket):
+    """
+    Serial port over a QEMU Unix socket.
+
+    Received data is pulled in large chunks into an internal buffer so that
+    readline() and small reads do not cost one syscall per byte. Writes use
+    sendall()/sendmsg() so nothing is silently dropped, and write() accepts
+    several buffers (e.g. memoryview slices of a frame) sent as one vector.
+    """
+
+    def __init__(self, ser_socket: socket.socket, timeout=None):
         self.ser_socket = ser_socket
-    
+        self.ser_socket.settimeout(timeout)
+        self.rx_buf = bytearray()
+
+    def set_timeout(self, timeout):
+        # None blocks forever; socket.timeout is raised on expiry
+        self.ser_socket.settimeout(timeout)
+
+    def _fill(self):
+        chunk = self.ser_socket.recv(RECV_CHUNK)
+        if not chunk:
+            raise EOFError("ERROR: serial socket closed")
+        self.rx_buf += chunk
+
     def read(self, length: int) -> bytes:
+        # Return between 1 and length bytes, like a single recv()
+        if length < 1:
+            raise ValueError("Read length must be at least 1 byte")
+
+        if not self.rx_buf:
+            self._fill()
+        data = bytes(self.rx_buf[:length])
+        del self.rx_buf[:length]
+        return data
+
+    def read_exact(self, length: int) -> bytes:
+        # Return exactly length bytes, blocking (up to the timeout) as needed
         if length < 1:
             raise ValueError("Read length must be at least 1 byte")
-        
-        return self.ser_socket.recv(length)
-    
+
+        while len(self.rx_buf) < length:
+            self._fill()
+        data = bytes(self.rx_buf[:length])
+        del self.rx_buf[:length]
+        return data
+
     def readline(self) -> bytes:
-        line = b""
-
-        c = self.ser_socket.recv(1)
-        while c != b"\n":
-            line += c
-            c = self.ser_socket.recv(1)
-        
-        line += b'\n'
+        start = 0
+        while True:
+            idx = self.rx_buf.find(b"\n", start)
+            if idx >= 0:
+                break
+            start = len(self.rx_buf)
+            self._fill()
+
+        line = bytes(self.rx_buf[:idx + 1])
+        del self.rx_buf[:idx + 1]
         return line
 
-    def write(self, data: bytes):
-        self.ser_socket.send(data)
+    def write(self, *buffers):
+        # Vectored write of every buffer in order, retried until all is sent
+        views = [memoryview(b).cast("B") for b in buffers if len(b)]
+        while views:
+            sent = self.ser_socket.sendmsg(views)
+            while views and sent >= len(views[0]):
+                sent -= len(views[0])
+                views.pop(0)
+            if views and sent:
+                views[0] = views[0][sent:]
 
     def close(self):
         self.ser_socket.close()
         del self
 
+class QemuMonitor:
+    """
+    QEMU human monitor (HMP) over its Unix socket, used to stop the VM and
+    save or restore snapshots while it runs.
+    """
+
+    PROMPT = b"(qemu) "
+
+    def __init__(self, path, timeout=None):
+        self.ser = DomainSocketSerial(connect_socket(path), timeout=timeout)
+        self._read_prompt()  # greeting banner
+
+    def _read_prompt(self):
+        out = bytearray()
+        while not out.endswith(self.PROMPT):
+            out += self.ser.read(RECV_CHUNK)
+        return bytes(out[:-len(self.PROMPT)]).decode(errors="replace")
+
+    def command(self, line):
+        # Run one HMP command and return its output; QEMU reports failures as text
+        self.ser.write(line.encode() + b"\n")
+        out = self._read_prompt()
+        if "Error" in out:
+            raise RuntimeError(f"ERROR: QEMU monitor '{line}' failed: {out.strip()}")
+        return out
+
+    def close(self):
+        self.ser.close()
+
+
 def print_hex(data):
     hex_string = ' '.join(format(byte, '02x') for byte in data)
-    print(hex_string)
\ No newline at end of file
+    print(hex_string)